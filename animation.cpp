@@ -1,6 +1,7 @@
 #include "animation.h"
 #include <OpenGl/glu.h>
 #include <math.h>
+#include <string.h>
 #include <vector>
 
 using namespace gnilk;
@@ -18,12 +19,22 @@ static AnimationRenderVars glbRenderVars = {
 
 void Strip::Normalize() {
 	for (int i=0;i<points.size();i++) {
-		points[i].fx = (float(points[i].x) - 128.0) / 128.0;
-		points[i].fy = (float(points[i].y) - 128.0) / 128.0;
+		NormalizePoint(points[i]);
 
 		// printf("      %f, %f\n", points[i].fx, points[i].fy);
 	}
 }
+void Strip::NormalizePoint(Point &pt) {
+	pt.fx = (float(pt.x) - 128.0) / 128.0;
+	pt.fy = (float(pt.y) - 128.0) / 128.0;
+}
+void Strip::AddPoint(uint8_t x, uint8_t y) {
+	Point pt;
+	pt.x = x;
+	pt.y = y;
+	NormalizePoint(pt);
+	points.push_back(pt);
+}
 float Strip::Len(int idxStart, int idxEnd) {
 	float dx = points[idxEnd].fx - points[idxStart].fx;
 	float dy = points[idxEnd].fy - points[idxStart].fy;
@@ -39,7 +50,9 @@ float Strip::FixLen(int idxStart, int idxEnd) {
 }
 
 void Strip::Load(FILE *f) {	
-	fread(&nPoints, sizeof(uint8_t), 1, f);
+	if (fread(&nPoints, sizeof(uint8_t), 1, f) != 1) {
+		nPoints = 0;
+	}
 	//printf("Points: %d",nPoints);
 	for (int p=0;p<nPoints;p++) {
 		uint8_t x,y;
@@ -79,8 +92,48 @@ void Strip::Render(bool highlight) {
 
 }
 
-void Frame::Load(FILE *f) {
-	fread(&nStrips, sizeof(uint8_t), 1, f);
+// 2x2 pen, same as DrawLine in the Go renderer
+static void RasterizeDot(unsigned char *dst, int width, int height, int bytesPerPixel, int x, int y) {
+	for (int dy=0;dy<2;dy++) {
+		for (int dx=0;dx<2;dx++) {
+			int px = x + dx;
+			int py = y + dy;
+			if ((px < width) && (py < height)) {
+				memset(&dst[(px + py * width) * bytesPerPixel], 255, bytesPerPixel);
+			}
+		}
+	}
+}
+
+//
+// Steps along each line one unit at a time like the Go renderer (renderStripsToFile), so a
+// frame rendered here matches the PNG it used to write pixel for pixel
+//
+void Strip::Rasterize(unsigned char *dst, int width, int height, int bytesPerPixel) {
+	for (int i=0;i<((int)points.size() - 1);i++) {
+		double dx = (double)points[i+1].x - (double)points[i].x;
+		double dy = (double)points[i+1].y - (double)points[i].y;
+		double len = sqrt(dx*dx + dy*dy);
+		if (len < 1.0) {
+			continue;
+		}
+		double xStep = dx / len;
+		double yStep = dy / len;
+		double xPos = points[i].x;
+		double yPos = points[i].y;
+		for (int j=0;j<(int)len;j++) {
+			RasterizeDot(dst, width, height, bytesPerPixel, (int)xPos, (int)yPos);
+			xPos += xStep;
+			yPos += yStep;
+		}
+	}
+}
+
+// false at the end of the file
+bool Frame::Load(FILE *f) {
+	if (fread(&nStrips, sizeof(uint8_t), 1, f) != 1) {
+		return false;
+	}
 	//printf("  Strips In Frame: %d\n", nStrips);
 	for(int i=0;i<nStrips;i++) {
 		Strip s;
@@ -89,6 +142,12 @@ void Frame::Load(FILE *f) {
 		//printf("\n");
 		strips.push_back(s);
 	}
+	return true;
+}
+
+void Frame::AddStrip(Strip strip) {
+	strips.push_back(strip);
+	nStrips = (uint8_t)strips.size();
 }
 
 void Frame::Render() {
@@ -104,6 +163,18 @@ void Frame::Render() {
 	}
 }
 
+void Frame::Rasterize(unsigned char *dst, int width, int height, int bytesPerPixel) {
+	memset(dst, 0, width * height * bytesPerPixel);
+	if (bytesPerPixel == 4) {
+		for (int i=0;i<width*height;i++) {
+			dst[i*4+3] = 255;
+		}
+	}
+	for (int i=0;i<strips.size();i++) {
+		strips[i].Rasterize(dst, width, height, bytesPerPixel);
+	}
+}
+
 void Frame::Dump() {
 	int totalPoints = 0;
 	printf("  Strips In Frame: %d\n", strips.size());
@@ -119,6 +190,7 @@ void Animation::LoadFromFile(const char *filename) {
 	FILE *f = fopen(filename,"r");
 	if (f == NULL) {
 		perror("Unable to open strips file");
+		return;
 	}
 
 	this->frames.clear();
@@ -127,7 +199,10 @@ void Animation::LoadFromFile(const char *filename) {
 	while(!feof(f)) {
 		//printf("Frame: %d, array: %d\n", frameCounter, frames.size());
 		Frame *frame = new Frame();
-		frame->Load(f);
+		if (!frame->Load(f)) {
+			delete frame;
+			break;
+		}
 		this->frames.push_back(frame);
 		// This is a frame!
 		frameCounter++;
@@ -139,6 +214,15 @@ void Animation::LoadFromFile(const char *filename) {
 
 	fclose(f);
 }
+void Animation::Clear() {
+	for (int i=0;i<frames.size();i++) {
+		delete frames[i];
+	}
+	frames.clear();
+}
+void Animation::AddFrame(Frame *frame) {
+	frames.push_back(frame);
+}
 int Animation::MaxStrips() {
 	int nStrips = 0;
 	for (int i=0;i<frames.size();i++) {
@@ -29,10 +29,13 @@ namespace gnilk {
 		std::vector<Point> points;
 	private:
 		void Normalize();
+		static void NormalizePoint(Point &pt);
 	public:
 		void Load(FILE *f);
+		void AddPoint(uint8_t x, uint8_t y);
 		int Points() { return points.size(); }
 		void Render(bool highlight = false);
+		void Rasterize(unsigned char *dst, int width, int height, int bytesPerPixel);
 		float Len(int idxStart, int idxEnd);
 		float FixLen(int idxStart, int idxEnd);
 	};
@@ -43,10 +46,13 @@ namespace gnilk {
 		std::vector<Strip> strips;
 	private:
 	public:
-		void Load(FILE *f);
+		bool Load(FILE *f);
+		void AddStrip(Strip strip);
 		int Strips() { return strips.size(); }
 		Strip At(int index) { return strips[index]; }
 		void Render();
+		// White lines on black, 'dst' is width x height at 1 (grey) or 4 (RGBA) bytes per pixel
+		void Rasterize(unsigned char *dst, int width, int height, int bytesPerPixel);
 		void Dump();
 	};
 
@@ -55,6 +61,8 @@ namespace gnilk {
 		std::vector<Frame *> frames;
 	public:
 		void LoadFromFile(const char *filename);
+		void Clear();
+		void AddFrame(Frame *frame);
 		int Frames() { return frames.size(); }
 		void Render(int frame, AnimationRenderVars vars);	
 		Frame *At(int index) { return frames[index]; }
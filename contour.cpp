@@ -1,39 +1,104 @@
 #include <math.h>
+#include <string.h>
 #include <map>
 #include <vector>
+#include <algorithm>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "contour.h"
 #include "bitmap.h"
 #include "vec2d.h"
 #include "timer.h"
+#include "logger.h"
 
 using namespace gnilk;
 using namespace gnilk::contour;
 
-static Config glbConfig;
+// Set by Trace::Update, per thread so independent sessions can trace on different threads
+static thread_local Config glbConfig;
+
+// Verbose output needs Config::Verbose and the debug level, arguments are not evaluated otherwise
+#define TRACE_VERBOSE(...) do { if (glbConfig.Verbose) { LOG_DEBUG(CACHED_LOGGER("Trace"), __VA_ARGS__); } } while(0)
+#define TRACE_INFO(...) LOG_INFO(CACHED_LOGGER("Trace"), __VA_ARGS__)
+#define TRACE_WARNING(...) LOG_WARNING(CACHED_LOGGER("Trace"), __VA_ARGS__)
+#define TRACE_ERROR(...) LOG_ERROR(CACHED_LOGGER("Trace"), __VA_ARGS__)
+
+// Structured diagnostics for the binary record sink, independent of Config::Verbose
+enum {
+	kTraceEvent_NewCluster = 1,
+	kTraceEvent_AngleCutOff,
+	kTraceEvent_LineCutOff,
+	kTraceEvent_LongLine,
+	kTraceEvent_OutOfRange,
+	kTraceEvent_OptSegment,
+};
+#define TRACE_EVENT(__event, ...) LOG_EVENT(CACHED_LOGGER("Trace"), Logger::kMCDebug, __event, __VA_ARGS__)
+
+// Trace sessions are created on any thread (sweep, tiles), the static initialization runs exactly once
+static void RegisterTraceEvents() {
+	static bool registered = []() {
+		Logger::RegisterEvent(kTraceEvent_NewCluster, "NewCluster", "pindex,dist");
+		Logger::RegisterEvent(kTraceEvent_AngleCutOff, "AngleCutOff", "iter,idxStart,idxPrevious,dist,dp");
+		Logger::RegisterEvent(kTraceEvent_LineCutOff, "LineCutOff", "iter,idxStart,idxPrevious,dist,dp");
+		Logger::RegisterEvent(kTraceEvent_LongLine, "LongLine", "idxStart,pindex,dist");
+		Logger::RegisterEvent(kTraceEvent_OutOfRange, "OutOfRange", "numDist,idxStart,idxPrevious,dp");
+		Logger::RegisterEvent(kTraceEvent_OptSegment, "OptSegment", "x1,y1,x2,y2,dev");
+		return true;
+	}();
+	(void)registered;
+}
 
 static float VecLen(Point *a, Point *b);
 
 
 Trace::Trace() {
+	bitmap = NULL;
+	blockmap = NULL;
+	planeWidth = 0;
+	planeHeight = 0;
+	intermediateWidth = 0;
+	intermediateHeight = 0;
+	dirtyStage = kStage_Scan;
+	rescanBlocks = false;
 	SetDefaultConfig();
+	RegisterTraceEvents();
+}
+
+Trace::~Trace() {
+	rescanBlocks = false;
+	ClearStage(kStage_Scan);
+	if (bitmap != NULL) {
+		delete bitmap;
+	}
 }
 
 void Trace::SetDefaultConfig() {
-	glbConfig.GreyThresholdLevel = 128;
-	glbConfig.ClusterCutOffDistance = 5.0f;
-	glbConfig.LineCutOffDistance = 5.0f;
-	glbConfig.LineCutOffAngle = 0.9f;
-	glbConfig.LongLineDistance = 3.0f;
-	glbConfig.OptimizationCutOffAngle = 0.95f;
-	glbConfig.ContrastFactor = 4; // NOT USED
-	glbConfig.ContrastScale = 2; // NOT USED
-	glbConfig.BlockSize = 8;
-	glbConfig.FilledBlockLevel = 0.5; // NOT USED
-	glbConfig.Width = 0;	// Set by initialization to with/height of bitmap
-	glbConfig.Height = 0;	// Set by initialization to with/height of bitmap
-	glbConfig.Optimize = true;
-	glbConfig.Verbose = false;
+	config = DefaultConfig();
+}
+
+Config Trace::DefaultConfig() {
+	Config config;
+	config.GreyThresholdLevel = 128;
+	config.ClusterCutOffDistance = 5.0f;
+	config.LineCutOffDistance = 5.0f;
+	config.LineCutOffAngle = 0.9f;
+	config.LongLineDistance = 3.0f;
+	config.OptimizationCutOffAngle = 0.95f;
+	config.ContrastFactor = 4;
+	config.ContrastScale = 2;
+	config.BlockSize = 8;
+	config.FilledBlockLevel = 0.5; // NOT USED
+	config.Width = 0;	// Set by initialization to with/height of bitmap
+	config.Height = 0;	// Set by initialization to with/height of bitmap
+	config.Optimize = true;
+	config.Verbose = false;
+	config.Engine = kEngine_DistanceSort;
+	config.Downscale = 1;
+	config.Thinning = false;
+	return config;
 }
 
 
@@ -41,48 +106,284 @@ void Trace::SetDefaultConfig() {
 // the input image should be processed and contain the contour of the image
 //
 void Trace::ProcessImage(unsigned char *data, int width, int height) {
-	// I believe this is bogus
-	glbConfig.Width = width;
-	glbConfig.Height = height;
-
-	intermediateWidth = width;
-	intermediateHeight = height;
-
-	Bitmap *bitmap = gnilk::Bitmap::FromRGBA(width, height, data);
-	BlockMap blockmap(bitmap);
-
-	std::vector<Strip *> optStrips;
-	std::vector<Strip *> strips;
-	std::vector<LineSegment *> optSegments;
-
 	Timer timer;
 	double tStart = timer.GetTime();
-	auto points = blockmap.ExtractContourPoints();
-	double tContourCluster = tStart - timer.GetTime();
-	ContourCluster cluster(points, &blockmap);
-	auto lineSegments = cluster.ExtractVectors();
-	double tExtractVector = timer.GetTime();
-
-	OptimizeLineSegments(optSegments, lineSegments);
-	LineSegmentsToStrips(optStrips, optSegments);
+	SetImage(data, width, height);
+	Update();
 	float tEnd = timer.GetTime();
 
 	// Draw cluster points to image - this is for intermediate imagery
 	//RescaleLineSegments(lineSegments, 255, 191);	// hard coded for now..
-	LineSegmentsToStrips(strips, lineSegments);
 
 	WriteStrips("player_strips.db", strips);
 	WriteStrips("player_opt_strips.db", optStrips);
 
 	auto imgLineSegments = DrawLineSegments(lineSegments);
 	imgLineSegments->SaveToFile("player_linesegments.png");
+	delete imgLineSegments;
 
 //	DumpStrips("Optimized Strips", optStrips);
 
 
 	auto imgCluster = DrawCluster(points);
 	imgCluster->SaveToFile("player_contourpoints.png");
-	printf("AlgoTime: %f\n", tEnd - tStart);
+	delete imgCluster;
+	TRACE_INFO("AlgoTime: %f", tEnd - tStart);
+}
+
+//
+// Incremental tracing, a session keeps the output of each stage and only recomputes
+// what a changed parameter actually affects. Changing 'oca' only re-runs the optimization,
+// changing 'lcd/lca/lld/ccd' re-runs extraction on the cached contour points.
+//
+void Trace::SetImage(unsigned char *data, int width, int height) {
+	// I believe this is bogus
+	config.Width = width;
+	config.Height = height;
+
+	intermediateWidth = width;
+	intermediateHeight = height;
+
+	Invalidate(kStage_Scan);
+	rescanBlocks = false;
+	if (bitmap != NULL) {
+		delete bitmap;
+	}
+	bitmap = gnilk::Bitmap::FromRGBA(width, height, data);
+	grey.Clear();
+}
+
+//
+// Next frame of a sequence, same as SetImage but the blockmap and contour points are kept.
+// The scan stage then only re-scans the blocks whose pixels differ from the previous frame.
+// Falls back to SetImage when the size changes or there is nothing to reuse.
+//
+void Trace::SetFrame(unsigned char *data, int width, int height) {
+	if ((blockmap == NULL) || (bitmap == NULL) || (bitmap->Width() != width) || (bitmap->Height() != height) ||
+		((dirtyStage == kStage_Scan) && !rescanBlocks)) {
+		SetImage(data, width, height);
+		return;
+	}
+	// Same size, the luma plane the blocks point to is rebuilt in place by the scan
+	memcpy(bitmap->Buffer(), data, width * height * 4);
+	Invalidate(kStage_Scan);
+	rescanBlocks = true;
+}
+
+//
+// Grey frames skip the RGBA -> luma conversion, with r = g = b the luma equals the grey value
+// so the contour is the same as for the expanded RGBA frame.
+//
+void Trace::SetGreyImage(const uint8_t *data, int width, int height) {
+	config.Width = width;
+	config.Height = height;
+
+	intermediateWidth = width;
+	intermediateHeight = height;
+
+	Invalidate(kStage_Scan);
+	rescanBlocks = false;
+	if (bitmap != NULL) {
+		delete bitmap;
+		bitmap = NULL;
+	}
+	grey.FromGrey(data, width, height);
+}
+
+void Trace::SetGreyFrame(const uint8_t *data, int width, int height) {
+	if ((blockmap == NULL) || (bitmap != NULL) || (grey.Width() != width) || (grey.Height() != height) ||
+		((dirtyStage == kStage_Scan) && !rescanBlocks)) {
+		SetGreyImage(data, width, height);
+		return;
+	}
+	grey.FromGrey(data, width, height);
+	Invalidate(kStage_Scan);
+	rescanBlocks = true;
+}
+
+void Trace::SetConfig(const Config &newConfig) {
+	Config tmp = newConfig;
+	// Dimensions always follow the image
+	tmp.Width = config.Width;
+	tmp.Height = config.Height;
+
+	Stage stage = FirstChangedStage(config, tmp);
+	if (stage == kStage_Scan) {
+		rescanBlocks = false;
+	}
+	Invalidate(stage);
+	config = tmp;
+}
+
+Trace::Stage Trace::FirstChangedStage(const Config &a, const Config &b) {
+	if ((a.GreyThresholdLevel != b.GreyThresholdLevel) ||
+		(a.BlockSize != b.BlockSize) ||
+		(a.Downscale != b.Downscale) ||
+		(a.Thinning != b.Thinning) ||
+		(a.ContrastFactor != b.ContrastFactor) ||
+		(a.ContrastScale != b.ContrastScale)) {
+		return kStage_Scan;
+	}
+	// The iso-line engine has no contour points, switching to/from it needs a new scan
+	if ((a.Engine != b.Engine) && ((a.Engine == kEngine_IsoLine) || (b.Engine == kEngine_IsoLine))) {
+		return kStage_Scan;
+	}
+	if ((a.ClusterCutOffDistance != b.ClusterCutOffDistance) ||
+		(a.LineCutOffDistance != b.LineCutOffDistance) ||
+		(a.LineCutOffAngle != b.LineCutOffAngle) ||
+		(a.LongLineDistance != b.LongLineDistance) ||
+		(a.Engine != b.Engine)) {
+		return kStage_Extract;
+	}
+	if ((a.OptimizationCutOffAngle != b.OptimizationCutOffAngle) ||
+		(a.Optimize != b.Optimize)) {
+		return kStage_Optimize;
+	}
+	return kStage_Done;
+}
+
+bool Trace::HasContrast(const Config &config) {
+	return (config.ContrastFactor != 1.0f) || (config.ContrastScale != 1.0f);
+}
+
+// Same mapping as the Go tracer, v = pow(v/255, factor) * scale * 255, truncated and clamped
+void Trace::BuildContrastLut(uint8_t *lut, float factor, float scale) {
+	for (int i=0;i<256;i++) {
+		double v = pow((double)i / 255.0, (double)factor) * (double)scale * 255.0;
+		lut[i] = (uint8_t)std::max(0.0, std::min(v, 255.0));
+	}
+}
+
+//
+// Frame -> luma plane, the contrast LUT (if any) is applied to r,g,b on the way.
+// The source is kept for a later contrast change.
+//
+void Trace::BuildLuma() {
+	uint8_t lut[256];
+	if (HasContrast(config)) {
+		BuildContrastLut(lut, config.ContrastFactor, config.ContrastScale);
+	}
+	const uint8_t *contrast = HasContrast(config) ? lut : NULL;
+	if (bitmap == NULL) {
+		luma.FromGrey(grey.Buffer(), grey.Width(), grey.Height(), contrast);
+		return;
+	}
+	luma.FromRGBA(bitmap, contrast);
+}
+
+void Trace::Invalidate(Stage stage) {
+	if (stage < dirtyStage) {
+		dirtyStage = stage;
+	}
+}
+
+//
+// Recomputes all invalidated stages, returns the first stage that was run (kStage_Done if none)
+//
+Trace::Stage Trace::Update() {
+	Stage first = dirtyStage;
+	if ((bitmap == NULL) && (grey.Width() == 0)) {
+		return kStage_Done;
+	}
+	glbConfig = config;
+	for (int stage = dirtyStage; stage < kStage_Done; stage++) {
+		ClearStage((Stage)stage);
+		RunStage((Stage)stage);
+	}
+	dirtyStage = kStage_Done;
+	return first;
+}
+
+// Frees the output of 'stage' and everything downstream of it
+void Trace::ClearStage(Stage stage) {
+	for (int i=0;i<optSegments.size();i++) {
+		delete optSegments[i];
+	}
+	optSegments.clear();
+	for (int i=0;i<optStrips.size();i++) {
+		delete optStrips[i];
+	}
+	optStrips.clear();
+	if (stage == kStage_Optimize) {
+		return;
+	}
+
+	for (int i=0;i<lineSegments.size();i++) {
+		delete lineSegments[i];
+	}
+	lineSegments.clear();
+	for (int i=0;i<strips.size();i++) {
+		delete strips[i];
+	}
+	strips.clear();
+	if (stage == kStage_Extract) {
+		// Contour points are kept, make them available for extraction again
+		for (int i=0;i<points.size();i++) {
+			points[i]->ResetUsage();
+		}
+		if (blockmap != NULL) {
+			blockmap->ResetExtraction();
+		}
+		return;
+	}
+
+	if (rescanBlocks && (blockmap != NULL)) {
+		// Points are owned by the blocks, unchanged blocks keep theirs on rescan
+		for (int i=0;i<points.size();i++) {
+			points[i]->ResetUsage();
+		}
+		blockmap->ResetExtraction();
+		points.clear();
+		return;
+	}
+	for (int i=0;i<points.size();i++) {
+		delete points[i];
+	}
+	points.clear();
+	plane.clear();
+	if (blockmap != NULL) {
+		delete blockmap;
+		blockmap = NULL;
+	}
+}
+
+void Trace::RunStage(Stage stage) {
+	switch(stage) {
+		case kStage_Scan :
+			BuildLuma();
+			if (config.Engine == kEngine_IsoLine) {
+				IsoLineTracer::BuildPlane(plane, &planeWidth, &planeHeight, &luma, config.Downscale);
+				break;
+			}
+			if (rescanBlocks && (blockmap != NULL)) {
+				blockmap->Rescan(points);
+				rescanBlocks = false;
+				break;
+			}
+			blockmap = new BlockMap(&luma);
+			points = blockmap->ExtractContourPoints();
+			break;
+		case kStage_Extract :
+			if (config.Engine == kEngine_IsoLine) {
+				IsoLineTracer tracer(plane, planeWidth, planeHeight, config.Downscale);
+				// Half a level above, samples are never exactly on the iso-line
+				lineSegments = tracer.ExtractVectors(config.GreyThresholdLevel + 0.5f);
+			} else if (config.Engine == kEngine_ChainCode) {
+				ChainCodeTracer tracer(points, luma.Width(), luma.Height());
+				lineSegments = tracer.ExtractVectors();
+			} else {
+				ContourCluster cluster(points, blockmap);
+				lineSegments = cluster.ExtractVectors();
+			}
+			LineSegmentsToStrips(strips, lineSegments);
+			break;
+		case kStage_Optimize :
+			OptimizeLineSegments(optSegments, lineSegments);
+			LineSegmentsToStrips(optStrips, optSegments);
+			break;
+		default:
+			break;
+	}
 }
 
 Bitmap *Trace::DrawLineSegments(std::vector<LineSegment *> &lineSegments) {
@@ -173,18 +474,14 @@ void Trace::OptimizeLineSegments(std::vector<LineSegment *> &newSegments, std::v
 
 			float dev = vStart.Dot(&vEnd);
 
-			if (glbConfig.Verbose) {
-				printf("%d, (%d,%d):(%d:%d) -> (%d,%d):(%d:%d) - dev: %f\n",i,
-					lsStart->Start().x, lsStart->Start().y, lsStart->End().x, lsStart->End().y,
-					lsEnd->Start().x, lsEnd->Start().y, lsEnd->End().x, lsEnd->End().y, 
-					dev);
-			}
+			TRACE_VERBOSE("%d, (%d,%d):(%d:%d) -> (%d,%d):(%d:%d) - dev: %f",i,
+				lsStart->Start().x, lsStart->Start().y, lsStart->End().x, lsStart->End().y,
+				lsEnd->Start().x, lsEnd->Start().y, lsEnd->End().x, lsEnd->End().y,
+				dev);
 
 			// line segments aligned?
 			if (dev > glbConfig.OptimizationCutOffAngle) {
-				if (glbConfig.Verbose) {
-					printf("  -> Opt\n");
-				}
+				TRACE_VERBOSE("  -> Opt");
 
 				LineSegment *lsPrev = lsStart;
 				for (; dev > glbConfig.OptimizationCutOffAngle; i++) {
@@ -192,18 +489,14 @@ void Trace::OptimizeLineSegments(std::vector<LineSegment *> &newSegments, std::v
 						break;
 					}
 					lsEnd = lineSegments[i];		
-					if (glbConfig.Verbose) {
-						printf("   %d, (%d,%d):(%d:%d) - dev: %f\n",i,
-							lsEnd->Start().x, lsEnd->Start().y, lsEnd->End().x, lsEnd->End().y, dev);				
-					}
+					TRACE_VERBOSE("   %d, (%d,%d):(%d:%d) - dev: %f",i,
+						lsEnd->Start().x, lsEnd->Start().y, lsEnd->End().x, lsEnd->End().y, dev);
 
 
 
 					// cluster check, if this does not belong to the same cluster (discontinuation), break loop and stop line optimization
 					if (!lsPrev->End().IsEqual(lsEnd->Start())) {
-						if (glbConfig.Verbose) {
-							printf("    Break Opt, new cluster detected\n");
-						}
+						TRACE_VERBOSE("    Break Opt, new cluster detected");
 						break;
 					}
 
@@ -215,30 +508,25 @@ void Trace::OptimizeLineSegments(std::vector<LineSegment *> &newSegments, std::v
 
 				// New linesegment here, contour.go:1589
 
-				if (glbConfig.Verbose) {
-					printf("  <- Opt\n");
-					printf("NewSeg: (%d,%d):(%d:%d) - dev: %f\n",
-								lsStart->Start().x, lsStart->Start().y, lsPrev->End().x, lsPrev->End().y, dev);				
-				}
+				TRACE_VERBOSE("  <- Opt");
+				TRACE_VERBOSE("NewSeg: (%d,%d):(%d:%d) - dev: %f",
+							lsStart->Start().x, lsStart->Start().y, lsPrev->End().x, lsPrev->End().y, dev);
+				TRACE_EVENT(kTraceEvent_OptSegment, lsStart->Start().x, lsStart->Start().y, lsPrev->End().x, lsPrev->End().y, dev);
 				auto lsNew = new LineSegment(lsStart->Start(), lsPrev->End());
 				if (lsNew->Len() < 2.0f) {
-					if (glbConfig.Verbose) {
-						printf("  OPT: WARNING SHORT LS DETECTED\n");
-					}
+					TRACE_VERBOSE("  OPT: WARNING SHORT LS DETECTED");
 				}
 				newSegments.push_back(lsNew);
 			} else {
 				if (lsStart->Len() < 2.0f) {
-					if (glbConfig.Verbose) {
-						printf("NO-OPT: short line segments: %f, skipping\n", lsStart->Len());
-					}
+					TRACE_VERBOSE("NO-OPT: short line segments: %f, skipping", lsStart->Len());
 				} else {
-					newSegments.push_back(lsStart);
+					newSegments.push_back(new LineSegment(*lsStart));
 				}
 			}
 		}
 	}
-	printf("Optimization, segments before: %d, after: %d\n",lineSegments.size(), newSegments.size());
+	TRACE_INFO("Optimization, segments before: %d, after: %d", (int)lineSegments.size(), (int)newSegments.size());
 }
 
 
@@ -255,9 +543,7 @@ int Trace::LineSegmentsToStrips(std::vector<Strip *> &strips, std::vector<LineSe
 		if (strip->size() > 1) {
 			auto dist = VecLen(&strip->at(strip->size()-1), ls->StartPtr());
 			if (dist < 2) {
-				if (glbConfig.Verbose) {
-					printf("  Warninig: At %d, short (%f) line segment detected, skipping\n", i, dist);
-				}
+				TRACE_VERBOSE("  Warninig: At %d, short (%f) line segment detected, skipping", i, dist);
 			} else {
 				strip->push_back(ls->Start());
 			}
@@ -269,9 +555,7 @@ int Trace::LineSegmentsToStrips(std::vector<Strip *> &strips, std::vector<LineSe
 		if (ls->End().IsEqual(lsNext->Start())) {
 			// If we are exceeding max 8bit length, create new strip and continue
 			if (strip->size() > (255-2)) {
-				if (glbConfig.Verbose) {
-					printf("Strip exceeding 255 items, splitting");
-				}
+				TRACE_VERBOSE("Strip exceeding 255 items, splitting");
 				strip->push_back(ls->End());
 				strips.push_back(strip);
 				strip = new Strip();
@@ -291,15 +575,11 @@ int Trace::LineSegmentsToStrips(std::vector<Strip *> &strips, std::vector<LineSe
 	if (lineSegments.size() > 1) {
 		auto ls = lineSegments[lineSegments.size() -1];
 		if (lsPrev->End().IsEqual(ls->Start())) {
-			if (glbConfig.Verbose) {
-				printf("Last LS append to current\n");
-			}
+			TRACE_VERBOSE("Last LS append to current");
 			strip->push_back(ls->Start());
 			strip->push_back(ls->End());
 		} else {
-			if (glbConfig.Verbose) {
-				printf("Last LS require new Strip [not implemented]\n");
-			}
+			TRACE_VERBOSE("Last LS require new Strip [not implemented]");
 			if (strip->size() > 0) {
 				strip->push_back(lsPrev->End());
 				strips.push_back(strip);
@@ -310,9 +590,7 @@ int Trace::LineSegmentsToStrips(std::vector<Strip *> &strips, std::vector<LineSe
 		}
 		strips.push_back(strip);
 	} else {
-		if (glbConfig.Verbose) {
-			printf("Only one segment, creating special strip [not implemented]\n");
-		}
+		TRACE_VERBOSE("Only one segment, creating special strip [not implemented]");
 	}
 
 	// printf("Dumping strips:\n");
@@ -324,26 +602,28 @@ int Trace::LineSegmentsToStrips(std::vector<Strip *> &strips, std::vector<LineSe
 
 void Trace::WriteStrips(std::string filename, std::vector<Strip *> &strips) {
 	FILE *f = fopen(filename.c_str(), "w");
-	printf("Strips: %d\n", strips.size());
-	uint8_t nStrips = (uint8_t)strips.size();
-	fwrite(&nStrips,1,1,f);
+	TRACE_INFO("Strips: %d", (int)strips.size());
+	std::string data;
+	SerializeStrips(data, strips);
+	fwrite(data.c_str(), 1, data.length(), f);
+	fclose(f);
+}
+
+// Appends one frame in the .db format, used for files and for the process pool replies
+void Trace::SerializeStrips(std::string &out, std::vector<Strip *> &strips) {
+	out.push_back((char)(uint8_t)strips.size());
 	for (int i=0;i<strips.size();i++) {
 		auto strip = strips[i];
-		//printf("  %d, Points: %d\n", i, strip->size());
 		if (strip->size() > 255) {
-			printf("WriteStrips failed, more (%d) than 255 points in on strip!!!", strip->size());
+			TRACE_ERROR("WriteStrips failed, more (%d) than 255 points in on strip!!!", (int)strip->size());
 		}
-		uint8_t nPoints = (uint8_t)strip->size();
-		fwrite(&nPoints, 1,1, f);
+		out.push_back((char)(uint8_t)strip->size());
 		for (int j =0;j<strip->size();j++) {
 			auto pt = strip->at(j);
-			uint8_t x = (uint8_t)pt.X();
-			uint8_t y = (uint8_t)pt.Y();
-			fwrite(&x,1,1,f);
-			fwrite(&y,1,1,f);
+			out.push_back((char)(uint8_t)pt.X());
+			out.push_back((char)(uint8_t)pt.Y());
 		}
 	}
-	fclose(f);
 }
 
 //
@@ -383,24 +663,20 @@ std::vector<LineSegment *> ContourCluster::ExtractVectors() {
 	// printf("Searched: %d blocks of %d\n", blockCount, blockmap->NumBlocks());
 	auto block = blockmap->GetBlockForExtraction(NULL);
 	if (block == NULL) {
-		printf("No blocks...");
-		exit(1);
+		TRACE_WARNING("No blocks...");
+		return lineSegments;
 	}
 	idxStart = block->points[0]->PIndex();
 
 	for (int i=0;i<points.size();i++) {
 		auto ls = NextSegment(idxStart);
 		if (ls == NULL) {
-			if (glbConfig.Verbose) {
-				printf("NextSegment, returned NULL - looking for new cluster!\n");
-			}
+			TRACE_VERBOSE("NextSegment, returned NULL - looking for new cluster!");
 			// Local search fail - cluster is somewhere else in picture
 			// Initiate search for a new block!
 			block = blockmap->GetBlockForExtraction(NULL);
 			if (block == NULL) {
-				if (glbConfig.Verbose) {
-					printf("No unprocessed cluster found, leaving!\n");
-				}
+				TRACE_VERBOSE("No unprocessed cluster found, leaving!");
 				break;
 			}
 			block->SetExtracted();
@@ -417,21 +693,17 @@ std::vector<LineSegment *> ContourCluster::ExtractVectors() {
 LineSegment *ContourCluster::NextSegment(int idxStart) {
 	// Calculate distance from all points to this point and sort low to high
 	// Note: The CalcPointDistance will discard any 'Used'/'Visisted' points in the cluster	
-	std::vector<PointDistance *> pds;
+	pds.clear();
 	CalcPointDistance(idxStart, pds);
 
 	// Sort pds
 	if (pds.size() < 2) {
-		if (glbConfig.Verbose) {
-			printf("Too few points in cluster left\n");
-		}
+		TRACE_VERBOSE("Too few points in cluster left");
 		return NULL;
 	}
 	std::sort(pds.begin(), pds.end(), PointDistance::Less);
 
-	if (glbConfig.Verbose) {
-		printf("NextSegment, idxStart: %d, number of pds: %d\n", idxStart, pds.size());
-	}
+	TRACE_VERBOSE("NextSegment, idxStart: %d, number of pds: %d", idxStart, (int)pds.size());
 
 	// for (int i=0;i<20;i++) {
 	// 	if (i >= pds.size()) {
@@ -441,20 +713,24 @@ LineSegment *ContourCluster::NextSegment(int idxStart) {
 	// }
 	// exit(1);
 
+	// Distances are squared, compare against squared thresholds
+	float clusterCutOff2 = glbConfig.ClusterCutOffDistance * glbConfig.ClusterCutOffDistance;
+	float lineCutOff2 = glbConfig.LineCutOffDistance * glbConfig.LineCutOffDistance;
+	float longLine2 = glbConfig.LongLineDistance * glbConfig.LongLineDistance;
+
 	bool longLineMode = false;
 	Vec2D *vPrev = NULL;
 	float dp = 0.0f;
 	int idxPrevious = -1;
 	for (int i=0;i<pds.size();i++) {
-		auto pd = pds[i];
+		auto pd = &pds[i];
 
 		//printf("%d, pd.PIndex: %d, pd.Distance: %f\n", i, pd->PIndex(), pd->Distance());
 
-		if ((idxPrevious == -1) && (pd->Distance() > glbConfig.ClusterCutOffDistance)) {
+		if ((idxPrevious == -1) && (pd->Distance2() > clusterCutOff2)) {
 			At(pd->PIndex())->Use();
-			if (glbConfig.Verbose) {
-				printf("New Cluster Detected, restarting loop");
-			}
+			TRACE_VERBOSE("New Cluster Detected, restarting loop");
+			TRACE_EVENT(kTraceEvent_NewCluster, pd->PIndex(), pd->Distance());
 			return NextSegment(pd->PIndex());
 		}
 
@@ -462,9 +738,7 @@ LineSegment *ContourCluster::NextSegment(int idxStart) {
 			auto vCurrent = NewVector(idxStart, pd->PIndex());
 			vCurrent->Norm();
 			dp = vPrev->Dot(vCurrent);
-			if (glbConfig.Verbose) {
-				printf("pd.PIndex: %d, dist: %f, dp: %f\n", pd->PIndex(), pd->Distance(), dp);
-			}
+			TRACE_VERBOSE("pd.PIndex: %d, dist: %f, dp: %f", pd->PIndex(), pd->Distance(), dp);
 		}
 
 		//
@@ -472,26 +746,23 @@ LineSegment *ContourCluster::NextSegment(int idxStart) {
 		//
 
 		if (longLineMode && (dp < glbConfig.LineCutOffAngle)) {
-			if (glbConfig.Verbose) {
-				printf("NewSegment, angelCutOff, iter: %d, %d -> %d, dist: %f, dp: %f\n", i, idxStart, idxPrevious, pd->Distance(), dp);
-				printf("            (%d:%d) -> (%d:%d)\n", At(idxStart)->X(), At(idxStart)->Y(), At(idxPrevious)->X(), At(idxPrevious)->Y());
-			}
+			TRACE_VERBOSE("NewSegment, angelCutOff, iter: %d, %d -> %d, dist: %f, dp: %f", i, idxStart, idxPrevious, pd->Distance(), dp);
+			TRACE_VERBOSE("            (%d:%d) -> (%d:%d)", At(idxStart)->X(), At(idxStart)->Y(), At(idxPrevious)->X(), At(idxPrevious)->Y());
+			TRACE_EVENT(kTraceEvent_AngleCutOff, i, idxStart, idxPrevious, pd->Distance(), dp);
 			return NewLineSegment(idxStart, idxPrevious);
-		} else if ((idxPrevious != -1) && (pd->Distance() > glbConfig.LineCutOffDistance)) {
-			if (glbConfig.Verbose) {
-				printf("NewSegment, lineCutOff, iter: %d, %d -> %d, dist: %f, dp: %f\n", i, idxStart, idxPrevious, pd->Distance(), dp);
-				printf("            (%d:%d) -> (%d:%d)\n", At(idxStart)->X(), At(idxStart)->Y(), At(idxPrevious)->X(), At(idxPrevious)->Y());
-			}
+		} else if ((idxPrevious != -1) && (pd->Distance2() > lineCutOff2)) {
+			TRACE_VERBOSE("NewSegment, lineCutOff, iter: %d, %d -> %d, dist: %f, dp: %f", i, idxStart, idxPrevious, pd->Distance(), dp);
+			TRACE_VERBOSE("            (%d:%d) -> (%d:%d)", At(idxStart)->X(), At(idxStart)->Y(), At(idxPrevious)->X(), At(idxPrevious)->Y());
+			TRACE_EVENT(kTraceEvent_LineCutOff, i, idxStart, idxPrevious, pd->Distance(), dp);
 			return NewLineSegment(idxStart, idxPrevious);
-		} else if ((!longLineMode) && (pd->Distance() > glbConfig.LongLineDistance)) {
+		} else if ((!longLineMode) && (pd->Distance2() > longLine2)) {
 			longLineMode = true;
 			vPrev = NewVector(idxStart, pd->PIndex());
 			vPrev->Norm();
-			if (glbConfig.Verbose) {
-				printf("LongLingMode: %d (%d:%d) -> %d (%d:%d)\n", 
-					idxStart, At(idxStart)->X(), At(idxStart)->Y(),
-					pd->PIndex(), At(pd->PIndex())->X(), At(pd->PIndex())->Y());				
-			}
+			TRACE_VERBOSE("LongLingMode: %d (%d:%d) -> %d (%d:%d)",
+				idxStart, At(idxStart)->X(), At(idxStart)->Y(),
+				pd->PIndex(), At(pd->PIndex())->X(), At(pd->PIndex())->Y());
+			TRACE_EVENT(kTraceEvent_LongLine, idxStart, pd->PIndex(), pd->Distance());
 		}
 		//printf("Put to use\n");
 		At(pd->PIndex())->Use();
@@ -500,12 +771,11 @@ LineSegment *ContourCluster::NextSegment(int idxStart) {
 	}
 
 	if (idxPrevious == -1) {
-		printf("No previous points, too few points left in cluster\n");
+		TRACE_VERBOSE("No previous points, too few points left in cluster");
 		return NULL;
 	}
-	if (glbConfig.Verbose) {
-		printf("NewSegment, out of range, num dist: %d, %d -> %d, dp: %f\n", pds.size(), idxStart, idxPrevious, dp);
-	}
+	TRACE_VERBOSE("NewSegment, out of range, num dist: %d, %d -> %d, dp: %f", (int)pds.size(), idxStart, idxPrevious, dp);
+	TRACE_EVENT(kTraceEvent_OutOfRange, pds.size(), idxStart, idxPrevious, dp);
 	auto lsNew = NewLineSegment(idxStart, idxPrevious);
 	return lsNew;
 }
@@ -515,12 +785,12 @@ LineSegment *ContourCluster::NewLineSegment(int idxA, int idxB) {
 	return ls;
 }
 
-void ContourCluster::CalcPointDistance(int pidx, std::vector<PointDistance *> &distances) {
+void ContourCluster::CalcPointDistance(int pidx, std::vector<PointDistance> &distances) {
 	return LocalSearchPointDistance(pidx, distances);
 	//return FullSearchPointDistance(pidx, distances);
 }
 
-void ContourCluster::FullSearchPointDistance(int pidx, std::vector<PointDistance *> &distances) {
+void ContourCluster::FullSearchPointDistance(int pidx, std::vector<PointDistance> &distances) {
 	//	Full range search - no block optimization, all points still in cluster taken into account
 	auto porigin = At(pidx);
 	//distances := make([]PointDistance, 0)
@@ -533,8 +803,9 @@ void ContourCluster::FullSearchPointDistance(int pidx, std::vector<PointDistance
 			continue;
 		}
 
-		float dist = porigin->Distance(At(i));
-		auto pdist = new PointDistance(porigin->Distance(At(i)), At(i)->PIndex());
+		int dx = At(i)->X() - porigin->X();
+		int dy = At(i)->Y() - porigin->Y();
+		PointDistance pdist(dx*dx + dy*dy, At(i)->PIndex());
 		// if (i < 10) {
 		// 	printf("%d, (%d,%d) -> (%d, %d), dist: %f\n", i, porigin->X(), porigin->Y(),At(i)->X(), At(i)->Y(), dist);
 		// }
@@ -555,85 +826,545 @@ void ContourCluster::FullSearchPointDistance(int pidx, std::vector<PointDistance
   -----------
   DL | D | DR
 */
-void ContourCluster::LocalSearchPointDistance(int pidx, std::vector<PointDistance *> &distances) {
+static const int localSearchOrder[9][2] = {
+	{ 0, 0}, {-1, 0}, { 1, 0},	// x, L, R
+	{ 0,-1}, {-1,-1}, { 1,-1},	// U, UL, UR
+	{ 0, 1}, {-1, 1}, { 1, 1},	// D, DL, DR
+};
+
+void ContourCluster::LocalSearchPointDistance(int pidx, std::vector<PointDistance> &distances) {
 	auto porigin = At(pidx);
 	auto blockOrigin = porigin->GetBlock();
+	int gx = blockOrigin->GridX();
+	int gy = blockOrigin->GridY();
+
+	// Exhausted blocks are cleared in the blockmap occupancy bits and never touched
+	for (int i=0;i<9;i++) {
+		auto block = blockmap->GetLiveBlock(gx + localSearchOrder[i][0], gy + localSearchOrder[i][1]);
+		if (block != NULL) {
+			block->CalcPointDistance(porigin, distances);
+		}
+	}
+}
+
+Vec2D *ContourCluster::NewVector(int idxA, int idxB) {
+	return new Vec2D(At(idxA)->Pt(), At(idxB)->Pt());	
+}
+
 
-	blockOrigin->CalcPointDistance(porigin, distances);
 
-	auto left = blockmap->Left(blockOrigin);
-	if (left != NULL) {
-		left->CalcPointDistance(porigin, distances);
+//
+// Same cut rules as ContourCluster::NextSegment, applied along a traced curve instead of by distance.
+// A segment ends when the direction deviates more than LineCutOffAngle once past LongLineDistance,
+// or when the next point is further away than LineCutOffDistance. The end point starts the next segment.
+// 'pindices' are the contour point indices of the polyline, NULL if there are none.
+//
+static void CutPolyline(std::vector<Point> &polyline, const int *pindices, std::vector<LineSegment *> &lineSegments) {
+	float lineCutOff2 = glbConfig.LineCutOffDistance * glbConfig.LineCutOffDistance;
+	float longLine2 = glbConfig.LongLineDistance * glbConfig.LongLineDistance;
+
+	int idxStart = 0;
+	while (idxStart < ((int)polyline.size() - 1)) {
+		Point ptStart = polyline[idxStart];
+		bool longLineMode = false;
+		Vec2D vPrev;
+		int k;
+		for (k = idxStart + 1; k < polyline.size(); k++) {
+			Point pt = polyline[k];
+			int dx = pt.x - ptStart.x;
+			int dy = pt.y - ptStart.y;
+			int d2 = dx*dx + dy*dy;
+			if (longLineMode) {
+				Vec2D vCurrent(ptStart, pt);
+				if (vPrev.Dot(vCurrent.Norm()) < glbConfig.LineCutOffAngle) {
+					break;
+				}
+			}
+			if ((k > (idxStart + 1)) && (d2 > lineCutOff2)) {
+				break;
+			}
+			if ((!longLineMode) && (d2 > longLine2)) {
+				longLineMode = true;
+				vPrev = Vec2D(ptStart, pt);
+				vPrev.Norm();
+			}
+		}
+		int idxEnd = k - 1;
+		if (pindices != NULL) {
+			lineSegments.push_back(new LineSegment(ptStart, polyline[idxEnd], pindices[idxStart], pindices[idxEnd]));
+		} else {
+			lineSegments.push_back(new LineSegment(ptStart, polyline[idxEnd]));
+		}
+		idxStart = idxEnd;
 	}
-	auto right = blockmap->Right(blockOrigin);
-	if (right != NULL) {
-		right->CalcPointDistance(porigin, distances);
+}
+
+//
+// ChainCodeTracer
+//
+
+// Chain code directions, 0 = east, counting clockwise (y down)
+static const int chainDirections[8][2] = {
+	{ 1, 0}, { 1, 1}, { 0, 1}, {-1, 1},
+	{-1, 0}, {-1,-1}, { 0,-1}, { 1,-1},
+};
+// Neighbour search order relative to the current direction, straight ahead first
+static const int chainSearchOrder[8] = { 0, 1, 7, 2, 6, 3, 5, 4 };
+// [sign(dy)+1][sign(dx)+1] -> direction
+static const int chainDirectionFromDelta[3][3] = {
+	{ 5, 6, 7 },
+	{ 4, 0, 0 },
+	{ 3, 2, 1 },
+};
+
+ChainCodeTracer::ChainCodeTracer(std::vector<ContourPoint *> &_points, int width, int height) :
+	points(_points)
+{
+	this->width = width;
+	this->height = height;
+	pixels.assign(width * height, -1);
+	// Blocks overlap by one pixel, duplicates keep the first point
+	for (int i=0;i<points.size();i++) {
+		int idx = points[i]->X() + points[i]->Y() * width;
+		if (pixels[idx] < 0) {
+			pixels[idx] = points[i]->PIndex();
+		}
 	}
+}
 
-	auto up = blockmap->Up(blockOrigin);
-	if (up != NULL) {
-		up->CalcPointDistance(porigin,distances);
+std::vector<LineSegment *> ChainCodeTracer::ExtractVectors() {
+	std::vector<LineSegment *> lineSegments;
+	std::vector<int> forward;
+	std::vector<int> chain;
+	int numChains = 0;
 
-		// do UL
-		left = blockmap->Left(up);
-		if (left != NULL) {
-			left->CalcPointDistance(porigin, distances);
+	for (int i=0;i<points.size();i++) {
+		int idx = points[i]->X() + points[i]->Y() * width;
+		if (pixels[idx] != points[i]->PIndex()) {
+			continue;	// traced or duplicate
+		}
+		pixels[idx] = -1;
+
+		// The start can be anywhere on the curve, trace both ways and join
+		forward.clear();
+		chain.clear();
+		int dir = Follow(points[i]->PIndex(), 0, forward);
+		if (dir >= 0) {
+			Follow(points[i]->PIndex(), (dir + 4) & 7, chain);
+			std::reverse(chain.begin(), chain.end());
 		}
+		chain.push_back(points[i]->PIndex());
+		chain.insert(chain.end(), forward.begin(), forward.end());
 
-		// do UR
-		right = blockmap->Right(up);
-		if (right != NULL) {
-			right->CalcPointDistance(porigin, distances);
+		if (chain.size() > 1) {
+			SplitChain(chain, lineSegments);
+			numChains++;
 		}
 	}
+	TRACE_VERBOSE("ChainCode, chains: %d, segments: %d", numChains, (int)lineSegments.size());
+	return lineSegments;
+}
 
-	auto down = blockmap->Down(blockOrigin);
-	if (down != NULL) {
-		down->CalcPointDistance(porigin,distances);
+//
+// Appends untraced neighbours to 'chain' until the curve ends, returns the direction of
+// the first step or -1 if there was none
+//
+int ChainCodeTracer::Follow(int pindex, int dir, std::vector<int> &chain) {
+	int x = points[pindex]->X();
+	int y = points[pindex]->Y();
+	int firstDir = -1;
+
+	for (;;) {
+		int next = NextNeighbour(x, y, dir);
+		if (next < 0) {
+			next = BridgeGap(x, y, dir);
+			if (next < 0) {
+				break;
+			}
+		}
+		if (firstDir < 0) {
+			firstDir = dir;
+		}
+		chain.push_back(next);
+	}
+	return firstDir;
+}
 
-		// DL
-		left = blockmap->Left(down);
-		if (left != NULL) {
-			left->CalcPointDistance(porigin, distances);
+// Moore neighbourhood of (x,y), searched from 'dir' outwards
+int ChainCodeTracer::NextNeighbour(int &x, int &y, int &dir) {
+	for (int i=0;i<8;i++) {
+		int d = (dir + chainSearchOrder[i]) & 7;
+		int nx = x + chainDirections[d][0];
+		int ny = y + chainDirections[d][1];
+		if ((nx < 0) || (nx >= width) || (ny < 0) || (ny >= height)) continue;
+		int next = pixels[nx + ny * width];
+		if (next >= 0) {
+			pixels[nx + ny * width] = -1;
+			x = nx;
+			y = ny;
+			dir = d;
+			return next;
 		}
-		// DR
-		right = blockmap->Right(down);
-		if (right != NULL) {
-			right->CalcPointDistance(porigin, distances);
+	}
+	return -1;
+}
+
+//
+// The threshold scan leaves small holes in the contours, continue with the closest
+// untraced pixel within ClusterCutOffDistance - further away is a new cluster
+//
+int ChainCodeTracer::BridgeGap(int &x, int &y, int &dir) {
+	int maxGap = (int)glbConfig.ClusterCutOffDistance;
+	float clusterCutOff2 = glbConfig.ClusterCutOffDistance * glbConfig.ClusterCutOffDistance;
+	int best = -1;
+	int bestDist2 = 0;
+	int bx = 0, by = 0;
+	for (int dy = -maxGap; dy <= maxGap; dy++) {
+		int ny = y + dy;
+		if ((ny < 0) || (ny >= height)) continue;
+		for (int dx = -maxGap; dx <= maxGap; dx++) {
+			int nx = x + dx;
+			if ((nx < 0) || (nx >= width)) continue;
+			int dist2 = dx*dx + dy*dy;
+			if ((dist2 > clusterCutOff2) || ((best >= 0) && (dist2 >= bestDist2))) continue;
+			if (pixels[nx + ny * width] >= 0) {
+				best = pixels[nx + ny * width];
+				bestDist2 = dist2;
+				bx = dx;
+				by = dy;
+			}
 		}
 	}
+	if (best < 0) {
+		return -1;
+	}
+	pixels[(x + bx) + (y + by) * width] = -1;
+	x += bx;
+	y += by;
+	// Closest chain code direction for the next search
+	dir = chainDirectionFromDelta[(by > 0) - (by < 0) + 1][(bx > 0) - (bx < 0) + 1];
+	return best;
 }
 
-Vec2D *ContourCluster::NewVector(int idxA, int idxB) {
-	return new Vec2D(At(idxA)->Pt(), At(idxB)->Pt());	
+void ChainCodeTracer::SplitChain(std::vector<int> &chain, std::vector<LineSegment *> &lineSegments) {
+	polyline.clear();
+	for (int i=0;i<chain.size();i++) {
+		polyline.push_back(points[chain[i]]->Pt());
+	}
+	CutPolyline(polyline, &chain[0], lineSegments);
 }
 
 
+//
+// IsoLineTracer
+//
+
+// Cell corners: bit 0 top left, 1 top right, 2 bottom right, 3 bottom left - set when above the iso level
+// Cell edges: 0 top, 1 right, 2 bottom, 3 left - each case connects one or two pairs of edges
+static const int isoCellSegments[16][4] = {
+	{-1,-1,-1,-1}, { 3, 0,-1,-1}, { 0, 1,-1,-1}, { 3, 1,-1,-1},
+	{ 1, 2,-1,-1}, { 3, 0, 1, 2}, { 0, 2,-1,-1}, { 3, 2,-1,-1},
+	{ 3, 2,-1,-1}, { 0, 2,-1,-1}, { 0, 1, 2, 3}, { 1, 2,-1,-1},
+	{ 3, 1,-1,-1}, { 0, 1,-1,-1}, { 3, 0,-1,-1}, {-1,-1,-1,-1},
+};
+
+IsoLineTracer::IsoLineTracer(const std::vector<uint8_t> &_plane, int width, int height, int scale) :
+	plane(_plane)
+{
+	this->width = width;
+	this->height = height;
+	this->scale = scale;
+	this->isoLevel = 0.0f;
+	this->numHorizontal = height * (width - 1);
+}
+
+//
+// Box filtered luma plane, the same luma Block::Scan reads
+//
+void IsoLineTracer::BuildPlane(std::vector<uint8_t> &plane, int *width, int *height, LumaPlane *luma, int scale) {
+	if (scale < 1) {
+		scale = 1;
+	}
+	int w = luma->Width() / scale;
+	int h = luma->Height() / scale;
+	int stride = luma->Width();
+	plane.resize(w * h);
+	for (int y=0;y<h;y++) {
+		for (int x=0;x<w;x++) {
+			const uint8_t *src = luma->Buffer() + (y * scale) * stride + (x * scale);
+			int sum = 0;
+			for (int sy=0;sy<scale;sy++) {
+				for (int sx=0;sx<scale;sx++) {
+					sum += src[sy * stride + sx];
+				}
+			}
+			plane[x + y * w] = (uint8_t)(sum / (scale * scale));
+		}
+	}
+	*width = w;
+	*height = h;
+}
+
+std::vector<LineSegment *> IsoLineTracer::ExtractVectors(float isoLevel) {
+	std::vector<LineSegment *> lineSegments;
+	if ((width < 2) || (height < 2)) {
+		return lineSegments;
+	}
+	this->isoLevel = isoLevel;
+	int numEdges = numHorizontal + (height - 1) * width;
+	links.assign(numEdges * 2, -1);
+	visited.assign(numEdges, 0);
+
+	for (int y=0;y<(height-1);y++) {
+		for (int x=0;x<(width-1);x++) {
+			const uint8_t *cell = &plane[x + y * width];
+			int tl = cell[0];
+			int tr = cell[1];
+			int bl = cell[width];
+			int br = cell[width + 1];
+			int idx = (tl > isoLevel) | ((tr > isoLevel) << 1) | ((br > isoLevel) << 2) | ((bl > isoLevel) << 3);
+			if ((idx == 0) || (idx == 15)) {
+				continue;
+			}
+			// Saddle, the center decides which diagonal is connected
+			if (((idx == 5) || (idx == 10)) && ((tl + tr + bl + br) * 0.25f > isoLevel)) {
+				idx ^= 15;
+			}
+			int edges[4] = {
+				x + y * (width - 1),
+				numHorizontal + x + 1 + y * width,
+				x + (y + 1) * (width - 1),
+				numHorizontal + x + y * width,
+			};
+			const int *seg = isoCellSegments[idx];
+			Link(edges[seg[0]], edges[seg[1]]);
+			if (seg[2] >= 0) {
+				Link(edges[seg[2]], edges[seg[3]]);
+			}
+		}
+	}
+
+	// Lines ending at the border first, so they are walked from one end - then closed loops
+	for (int e=0;e<numEdges;e++) {
+		if (!visited[e] && (links[e*2] >= 0) && (links[e*2+1] < 0)) {
+			Walk(e, lineSegments);
+		}
+	}
+	for (int e=0;e<numEdges;e++) {
+		if (!visited[e] && (links[e*2] >= 0)) {
+			Walk(e, lineSegments);
+		}
+	}
+	TRACE_VERBOSE("IsoLine, plane: %dx%d, segments: %d", width, height, (int)lineSegments.size());
+	return lineSegments;
+}
+
+void IsoLineTracer::Link(int edgeA, int edgeB) {
+	links[edgeA * 2 + ((links[edgeA * 2] < 0) ? 0 : 1)] = edgeB;
+	links[edgeB * 2 + ((links[edgeB * 2] < 0) ? 0 : 1)] = edgeA;
+}
+
+// Interpolated crossing on 'edge', in image coordinates
+Point IsoLineTracer::EdgePoint(int edge) {
+	float px, py;
+	if (edge < numHorizontal) {
+		int x = edge % (width - 1);
+		int y = edge / (width - 1);
+		float a = plane[x + y * width];
+		float b = plane[x + 1 + y * width];
+		px = x + (isoLevel - a) / (b - a);
+		py = (float)y;
+	} else {
+		int x = (edge - numHorizontal) % width;
+		int y = (edge - numHorizontal) / width;
+		float a = plane[x + y * width];
+		float b = plane[x + (y + 1) * width];
+		px = (float)x;
+		py = y + (isoLevel - a) / (b - a);
+	}
+	// Plane samples sit in the middle of each scale x scale source block
+	float offset = (scale - 1) * 0.5f;
+	return Point((int)(px * scale + offset + 0.5f), (int)(py * scale + offset + 0.5f));
+}
+
+void IsoLineTracer::Walk(int edge, std::vector<LineSegment *> &lineSegments) {
+	polyline.clear();
+	int previous = -1;
+	int current = edge;
+	while ((current >= 0) && !visited[current]) {
+		visited[current] = 1;
+		Point pt = EdgePoint(current);
+		if (polyline.empty() || !polyline.back().IsEqual(pt)) {
+			polyline.push_back(pt);
+		}
+		int next = links[current * 2];
+		if ((next == previous) || (next < 0)) {
+			next = links[current * 2 + 1];
+		}
+		previous = current;
+		current = next;
+	}
+	// Closed loop, end where it started
+	if ((current == edge) && (polyline.size() > 2)) {
+		polyline.push_back(polyline[0]);
+	}
+	CutPolyline(polyline, NULL, lineSegments);
+}
+
+//
+// LumaPlane
+//
+
+// BT.601 weights as in Go's color.GrayModel, y = (19595r + 38470g + 7471b) * 257 + 2^15 >> 24.
+// 38470 doesn't fit a signed 16-bit multiplier, green is weighted as 2 x 19235 instead.
+static const int kLumaR = 19595;
+static const int kLumaG = 38470;
+static const int kLumaB = 7471;
+
+static inline uint8_t LumaFromSum(uint32_t sum) {
+	return (uint8_t)((sum * 257 + (1 << 15)) >> 24);
+}
+
+LumaPlane::LumaPlane() {
+	this->width = 0;
+	this->height = 0;
+}
+
+//
+// Converts 'src' to luma, with 'lut' each of r,g,b is mapped through it before the weighting.
+// The LUT is applied to small chunks which are then converted while still in cache, so the
+// frame is only read once either way.
+//
+void LumaPlane::FromRGBA(Bitmap *src, const uint8_t *lut /*= NULL*/) {
+	const int chunkPixels = 256;
+	width = src->Width();
+	height = src->Height();
+	data.resize(width * height);
+	int numPixels = width * height;
+	if (lut == NULL) {
+		RGBAToLuma(data.data(), src->Buffer(), numPixels);
+		return;
+	}
+	unsigned char chunk[chunkPixels * 4];
+	for (int i=0;i<numPixels;i+=chunkPixels) {
+		int n = std::min(chunkPixels, numPixels - i);
+		const unsigned char *rgba = src->Buffer() + i * 4;
+		for (int j=0;j<n;j++) {
+			chunk[j*4+0] = lut[rgba[j*4+0]];
+			chunk[j*4+1] = lut[rgba[j*4+1]];
+			chunk[j*4+2] = lut[rgba[j*4+2]];
+		}
+		RGBAToLuma(&data[i], chunk, n);
+	}
+}
+
+// 8-bit grey frame, with 'lut' each value is mapped through it
+void LumaPlane::FromGrey(const uint8_t *src, int width, int height, const uint8_t *lut /*= NULL*/) {
+	int numPixels = width * height;
+	this->width = width;
+	this->height = height;
+	data.resize(numPixels);
+	if (lut == NULL) {
+		memcpy(data.data(), src, numPixels);
+		return;
+	}
+	uint8_t *dst = data.data();
+	for (int i=0;i<numPixels;i++) {
+		dst[i] = lut[src[i]];
+	}
+}
+
+void LumaPlane::Clear() {
+	width = 0;
+	height = 0;
+	data.clear();
+}
+
+#ifdef __SSE2__
+// 4 pixels from two madd results, (r*wr + g*wg, b*wb) per pixel -> y per pixel
+static inline __m128i LumaSumPairs(__m128i p01, __m128i p23) {
+	__m128 a = _mm_castsi128_ps(p01);
+	__m128 b = _mm_castsi128_ps(p23);
+	__m128i rg = _mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2,0,2,0)));
+	__m128i bb = _mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(3,1,3,1)));
+	// sum * 257 + 2^15 >> 24, fits 32 bits unsigned
+	__m128i sum = _mm_add_epi32(rg, bb);
+	sum = _mm_add_epi32(_mm_add_epi32(sum, _mm_slli_epi32(sum, 8)), _mm_set1_epi32(1 << 15));
+	return _mm_srli_epi32(sum, 24);
+}
+#endif
+
+void LumaPlane::RGBAToLuma(uint8_t *dst, const unsigned char *rgba, int n) {
+	int i = 0;
+#ifdef __SSE2__
+	const __m128i weights = _mm_setr_epi16(kLumaR, kLumaG / 2, kLumaB, 0, kLumaR, kLumaG / 2, kLumaB, 0);
+	const __m128i green = _mm_setr_epi16(0, kLumaG / 2, 0, 0, 0, kLumaG / 2, 0, 0);
+	const __m128i zero = _mm_setzero_si128();
+	for (; (i + 16) <= n; i += 16) {
+		__m128i y[4];
+		for (int k=0;k<4;k++) {
+			__m128i v = _mm_loadu_si128((const __m128i *)&rgba[(i + k*4) * 4]);
+			__m128i lo = _mm_unpacklo_epi8(v, zero);
+			__m128i hi = _mm_unpackhi_epi8(v, zero);
+			__m128i p01 = _mm_add_epi32(_mm_madd_epi16(lo, weights), _mm_madd_epi16(lo, green));
+			__m128i p23 = _mm_add_epi32(_mm_madd_epi16(hi, weights), _mm_madd_epi16(hi, green));
+			y[k] = LumaSumPairs(p01, p23);
+		}
+		// values are 0..255, the signed packs can't saturate
+		__m128i lo = _mm_packs_epi32(y[0], y[1]);
+		__m128i hi = _mm_packs_epi32(y[2], y[3]);
+		_mm_storeu_si128((__m128i *)&dst[i], _mm_packus_epi16(lo, hi));
+	}
+#endif
+	for (; i < n; i++) {
+		const unsigned char *px = &rgba[i*4];
+		dst[i] = LumaFromSum(kLumaR * px[0] + kLumaG * px[1] + kLumaB * px[2]);
+	}
+}
 
 //
 // Implementation of block class
 //
 
-Block::Block(Bitmap *bitmap, int x, int y) {
-	this->bitmap = bitmap;
+Block::Block(BlockMap *blockmap, LumaPlane *luma, int x, int y, int index) {
+	this->blockmap = blockmap;
+	this->luma = luma;
 	this->x = x;
 	this->y = y;
+	this->index = index;
+	this->numLive = 0;
 	this->visited = false;
 	this->extracted = false;
+	this->flat = false;
 }
 uint8_t Block::ReadGreyPixel(int x, int y){
-	return bitmap->Buffer(x,y)[0];
+	return luma->At(x,y);
 }
 float Block::PixelAsFloat(int x, int y) {
-	uint8_t c = bitmap->Buffer(x,y)[0];
+	uint8_t c = luma->At(x,y);
 	return (float)c;
 }
+// Linear grid index of the block at pixel x,y, -1 outside the grid
 int Block::HashFunc(int x, int y) {
-	return x + y * 1024;
+	if ((x < 0) || (y < 0)) {
+		return -1;
+	}
+	int gx = x / glbConfig.BlockSize;
+	int gy = y / glbConfig.BlockSize;
+	if ((gx >= blockmap->GridWidth()) || (gy >= blockmap->GridHeight())) {
+		return -1;
+	}
+	return gx + gy * blockmap->GridWidth();
 }
 int Block::Hash() {
 	return HashFunc(x,y);
 }
+int Block::GridX() {
+	return x / glbConfig.BlockSize;
+}
+int Block::GridY() {
+	return y / glbConfig.BlockSize;
+}
 int Block::Left() {
 	return HashFunc(x - glbConfig.BlockSize, y);
 }
@@ -647,13 +1378,38 @@ int Block::Down() {
 	return HashFunc(x, y + glbConfig.BlockSize);
 }
 
-void Block::Scan(std::vector<ContourPoint *> &pnts) {
+// Largest delta to the left/upper neighbour, 0 outside the image
+float Block::EdgeStrength(int x, int y) {
+	if (!luma->Inside(x, y) || !luma->Inside(x - 1, y) || !luma->Inside(x, y - 1)) {
+		return 0.0f;
+	}
+	float c = PixelAsFloat(x, y);
+	return std::max(fabs(PixelAsFloat(x - 1, y) - c), fabs(PixelAsFloat(x, y - 1) - c));
+}
+
+//
+// Non-maximum suppression, a soft edge passes the threshold on several pixels across the edge.
+// Only the strongest one along the dominant delta is kept, the first one on a plateau.
+//
+bool Block::IsEdgeMaximum(int x, int y, float deltaX, float deltaY) {
+	float strength = std::max(deltaX, deltaY);
+	int sx = (deltaX >= deltaY) ? 1 : 0;
+	int sy = 1 - sx;
+	return (strength > EdgeStrength(x - sx, y - sy)) && (strength >= EdgeStrength(x + sx, y + sy));
+}
+
+// Returns the number of points removed by thinning
+int Block::Scan(std::vector<ContourPoint *> &pnts) {
+	int numThinned = 0;
+	if (flat) {
+		return 0;
+	}
 	for (int y=0;y<(glbConfig.BlockSize + 1);y++) {
 		for (int x=0;x<(glbConfig.BlockSize + 1);x++) {
 			// Check if pixel's is within bounds
-			if (!bitmap->Inside(this->x + x, this->y + y)) continue;
-			if (!bitmap->Inside(this->x + x - 1, this->y + y)) continue;
-			if (!bitmap->Inside(this->x + x, this->y + y - 1)) continue;
+			if (!luma->Inside(this->x + x, this->y + y)) continue;
+			if (!luma->Inside(this->x + x - 1, this->y + y)) continue;
+			if (!luma->Inside(this->x + x, this->y + y - 1)) continue;
 
 			float c = PixelAsFloat(this->x + x, this->y + y);
 			float l = PixelAsFloat(this->x + x - 1, this->y + y);
@@ -666,29 +1422,96 @@ void Block::Scan(std::vector<ContourPoint *> &pnts) {
 			float delta_y = fabs(u - c);
 
 			if ((delta_x > glbConfig.GreyThresholdLevel) || (delta_y > glbConfig.GreyThresholdLevel)) {
+				if (glbConfig.Thinning && !IsEdgeMaximum(this->x + x, this->y + y, delta_x, delta_y)) {
+					numThinned++;
+					continue;
+				}
 				ContourPoint *cpt = new ContourPoint(this->x + x, this->y + y, this);
 				pnts.push_back(cpt);
-				this->points.push_back(cpt);	// Need local copy for optimized search!
+				AddPoint(cpt);	// Need local copy for optimized search!
 			}
 		}
 	}
+	return numThinned;
 }
 
-void Block::CalcPointDistance(ContourPoint *cp, std::vector<PointDistance *> &distances) {
-	for (int i=0;i<this->points.size();i++) {
-		ContourPoint *pt = this->points[i];
-		if (pt->PIndex() == cp->PIndex()) {
-			continue;
-		}
+// Frees all points of this block, used before the block is scanned again
+void Block::ClearPoints() {
+	for (int i=0;i<points.size();i++) {
+		delete points[i];
+	}
+	points.clear();
+	coords.clear();
+	indices.clear();
+	used.clear();
+	numLive = 0;
+	blockmap->SetLive(this, false);
+}
 
-		if (pt->IsUsed()) {
-			continue;
-		}
+void Block::AddPoint(ContourPoint *cp) {
+	cp->SetBIndex(points.size());
+	points.push_back(cp);
+	coords.push_back((int16_t)cp->X());
+	coords.push_back((int16_t)cp->Y());
+	indices.push_back(cp->PIndex());
+	used.push_back(cp->IsUsed()?1:0);
+	if (!cp->IsUsed()) {
+		numLive++;
+		blockmap->SetLive(this, true);
+	}
+}
 
-		float dist = cp->Distance(pt);
-		PointDistance *pd = new PointDistance(dist, pt->PIndex());
-		distances.push_back(pd);
+void Block::MarkUsed(int bindex, bool isUsed) {
+	uint8_t value = isUsed?1:0;
+	if (used[bindex] == value) {
+		return;
 	}
+	used[bindex] = value;
+	numLive += isUsed?-1:1;
+	blockmap->SetLive(this, numLive > 0);
+}
+
+//
+// Squared distance from 'cp' to all points in this block, used points and 'cp' itself are masked out.
+// Result is appended to 'distances' as compacted (dist^2, pindex) pairs in block order.
+// Coordinates are stored as interleaved int16 pairs so dx*dx+dy*dy is a single madd per 4 points.
+// Beyond 32767 the stored coordinates wrap, the deltas are taken in int16 in both paths and stay
+// exact as long as the points are less than 32768 apart, which neighbouring blocks always are.
+//
+void Block::CalcPointDistance(ContourPoint *cp, std::vector<PointDistance> &distances) {
+	int n = NumPoints();
+	if (numLive == 0) {
+		return;
+	}
+	int self = (cp->GetBlock() == this) ? cp->BIndex() : -1;
+
+	size_t base = distances.size();
+	distances.resize(base + n);
+	PointDistance *dst = &distances[base];
+	int count = 0;
+
+	int i = 0;
+#ifdef __SSE2__
+	int32_t d2[4];
+	__m128i origin = _mm_set1_epi32((int32_t)(((uint32_t)(uint16_t)cp->Y() << 16) | (uint16_t)cp->X()));
+	for (; (i + 4) <= n; i += 4) {
+		__m128i xy = _mm_loadu_si128((const __m128i *)&coords[i*2]);
+		__m128i delta = _mm_sub_epi16(xy, origin);
+		_mm_storeu_si128((__m128i *)d2, _mm_madd_epi16(delta, delta));
+		for (int k = 0; k < 4; k++) {
+			// Branchless compaction, always write - only advance for live points
+			dst[count] = PointDistance(d2[k], indices[i+k]);
+			count += ((used[i+k] == 0) & ((i+k) != self));
+		}
+	}
+#endif
+	for (; i < n; i++) {
+		int dx = (int16_t)(coords[i*2+0] - (int16_t)cp->X());
+		int dy = (int16_t)(coords[i*2+1] - (int16_t)cp->Y());
+		dst[count] = PointDistance(dx*dx + dy*dy, indices[i]);
+		count += ((used[i] == 0) & (i != self));
+	}
+	distances.resize(base + count);
 }
 
 
@@ -696,21 +1519,30 @@ void Block::CalcPointDistance(ContourPoint *cp, std::vector<PointDistance *> &di
 // Blockmap
 //
 
-BlockMap::BlockMap(Bitmap *bitmap) {
-	this->bitmap = bitmap;
+BlockMap::BlockMap(LumaPlane *luma) {
+	this->luma = luma;
+	this->numThinned = 0;
 	BuildBlocks();
 }
+BlockMap::~BlockMap() {
+	for (int i=0;i<grid.size();i++) {
+		delete grid[i];
+	}
+}
+void BlockMap::ResetExtraction() {
+	for (int i=0;i<grid.size();i++) {
+		grid[i]->ResetExtracted();
+	}
+}
 Block *BlockMap::GetBlockForExtraction(Block *previous /*= NULL*/) {
 	// TODO: This should only be done for the first one, otherwise recursive travel
 	if (previous == NULL) {
-		auto it = blocks.begin();
-		while (it != blocks.end()) {
-			Block *b = it->second;
+		for (int i=0;i<grid.size();i++) {
+			Block *b = grid[i];
 			if ((!b->IsExtracted()) && (b->NumPoints() > 0)) {
 				return b;
 			}
-			it++;
-		}		
+		}
 	} else {
 		return GetBlockForExtractionRecursive(previous);
 	}
@@ -733,21 +1565,157 @@ Block *BlockMap::GetBlockForExtractionRecursive(Block *previous) {
 }
 
 void BlockMap::BuildBlocks() {
-	for (int y=0;y<this->bitmap->Height()/glbConfig.BlockSize;y++) {
-		for (int x=0;x<this->bitmap->Width()/glbConfig.BlockSize;x++) {
-			auto block = new Block(this->bitmap, x * glbConfig.BlockSize, y * glbConfig.BlockSize);
-			blocks[block->Hash()] = block;
+	gridWidth = this->luma->Width()/glbConfig.BlockSize;
+	gridHeight = this->luma->Height()/glbConfig.BlockSize;
+	grid.resize(gridWidth * gridHeight);
+	liveBits.assign((grid.size() + 63) / 64, 0);
+
+	for (int y=0;y<gridHeight;y++) {
+		for (int x=0;x<gridWidth;x++) {
+			auto block = new Block(this, this->luma, x * glbConfig.BlockSize, y * glbConfig.BlockSize, x + y * gridWidth);
+			grid[block->Index()] = block;
+		}
+	}
+	ScanCells();
+	MarkFlatBlocks();
+}
+
+// Min/max of 'n' luma samples
+static void GreyMinMax(const uint8_t *grey, int n, int &lo, int &hi) {
+	int i = 0;
+#ifdef __SSE2__
+	if (n >= 16) {
+		__m128i vmin = _mm_set1_epi8((char)0xff);
+		__m128i vmax = _mm_setzero_si128();
+		for (; (i + 16) <= n; i += 16) {
+			__m128i v = _mm_loadu_si128((const __m128i *)&grey[i]);
+			vmin = _mm_min_epu8(vmin, v);
+			vmax = _mm_max_epu8(vmax, v);
+		}
+		uint8_t mins[16], maxs[16];
+		_mm_storeu_si128((__m128i *)mins, vmin);
+		_mm_storeu_si128((__m128i *)maxs, vmax);
+		for (int k=0;k<16;k++) {
+			lo = std::min(lo, (int)mins[k]);
+			hi = std::max(hi, (int)maxs[k]);
+		}
+	}
+#endif
+	for (; i < n; i++) {
+		lo = std::min(lo, (int)grey[i]);
+		hi = std::max(hi, (int)grey[i]);
+	}
+}
+
+//
+// Min/max per block sized cell in one pass over the luma plane, the plane is kept for Rescan
+//
+void BlockMap::ScanCells() {
+	int bs = glbConfig.BlockSize;
+	int width = luma->Width();
+	int height = luma->Height();
+	cellsX = (width + bs - 1) / bs;
+	cellsY = (height + bs - 1) / bs;
+	cellMin.assign(cellsX * cellsY, 255);
+	cellMax.assign(cellsX * cellsY, 0);
+
+	for (int y=0;y<height;y++) {
+		const uint8_t *row = luma->Buffer() + y * width;
+		int *rowMin = &cellMin[(y / bs) * cellsX];
+		int *rowMax = &cellMax[(y / bs) * cellsX];
+		for (int cx=0;cx<cellsX;cx++) {
+			int x = cx * bs;
+			int n = std::min(bs, width - x);
+			GreyMinMax(&row[x], n, rowMin[cx], rowMax[cx]);
+		}
+	}
+	prevLuma.assign(luma->Buffer(), luma->Buffer() + (size_t)width * height);
+}
+
+//
+// Block::Scan compares each pixel with its left and upper neighbour over the block plus a one
+// pixel border. If max - min of that footprint is within GreyThresholdLevel no pixel can pass,
+// so the block is skipped. The footprint is covered by the 3x3 cells around the block.
+//
+void BlockMap::MarkFlatBlocks() {
+	int numFlat = 0;
+	for (int gy=0;gy<gridHeight;gy++) {
+		for (int gx=0;gx<gridWidth;gx++) {
+			int lo = 255;
+			int hi = 0;
+			for (int cy=std::max(gy-1, 0);cy<=std::min(gy+1, cellsY-1);cy++) {
+				for (int cx=std::max(gx-1, 0);cx<=std::min(gx+1, cellsX-1);cx++) {
+					lo = std::min(lo, cellMin[cx + cy * cellsX]);
+					hi = std::max(hi, cellMax[cx + cy * cellsX]);
+				}
+			}
+			bool isFlat = ((hi - lo) <= glbConfig.GreyThresholdLevel);
+			grid[gx + gy * gridWidth]->SetFlat(isFlat);
+			numFlat += isFlat?1:0;
+		}
+	}
+	TRACE_INFO("Flat blocks: %d of %d skipped (%.1f%%)", numFlat, (int)grid.size(),
+		grid.empty() ? 0.0f : (100.0f * numFlat / grid.size()));
+}
+
+// Flags the cells where any luma sample differs from the last scanned frame
+void BlockMap::FindChangedCells(std::vector<uint8_t> &changed) {
+	int bs = glbConfig.BlockSize;
+	int width = luma->Width();
+	int height = luma->Height();
+	changed.assign(cellsX * cellsY, 0);
+	for (int y=0;y<height;y++) {
+		const uint8_t *row = luma->Buffer() + y * width;
+		const uint8_t *prevRow = &prevLuma[(size_t)y * width];
+		uint8_t *rowChanged = &changed[(y / bs) * cellsX];
+		for (int cx=0;cx<cellsX;cx++) {
+			int x = cx * bs;
+			if (!rowChanged[cx] && memcmp(&row[x], &prevRow[x], std::min(bs, width - x))) {
+				rowChanged[cx] = 1;
+			}
+		}
+	}
+}
+
+// True if any of the 3x3 cells covering the scan footprint of the block differs from the previous frame.
+// With thinning the footprint grows by one more pixel on each side, still inside the 3x3 cells.
+bool BlockMap::IsChanged(const std::vector<uint8_t> &changed, int gx, int gy) {
+	for (int cy=std::max(gy-1, 0);cy<=std::min(gy+1, cellsY-1);cy++) {
+		for (int cx=std::max(gx-1, 0);cx<=std::min(gx+1, cellsX-1);cx++) {
+			if (changed[cx + cy * cellsX]) {
+				return true;
+			}
 		}
 	}
+	return false;
+}
+
+Block *BlockMap::GetLiveBlock(int gx, int gy) {
+	if ((gx < 0) || (gx >= gridWidth) || (gy < 0) || (gy >= gridHeight)) {
+		return NULL;
+	}
+	int idx = gx + gy * gridWidth;
+	if (!(liveBits[idx >> 6] & (1ULL << (idx & 63)))) {
+		return NULL;
+	}
+	return grid[idx];
+}
+
+void BlockMap::SetLive(Block *block, bool live) {
+	int idx = block->Index();
+	if (live) {
+		liveBits[idx >> 6] |= (1ULL << (idx & 63));
+	} else {
+		liveBits[idx >> 6] &= ~(1ULL << (idx & 63));
+	}
 }
 
 
 Block *BlockMap::GetBlock(int hashValue) {
-	auto it = blocks.find(hashValue);
-	if (it == blocks.end()) {
+	if ((hashValue < 0) || (hashValue >= grid.size())) {
 		return NULL;
 	}
-	return it->second; 
+	return grid[hashValue];
 }
 Block *BlockMap::Left(Block *block) {
 	return GetBlock(block->Left());
@@ -762,44 +1730,45 @@ Block *BlockMap::Down(Block *block) {
 	return GetBlock(block->Down());
 }
 
+//
+// Depth first over the blocks - left, right, up, down - with an explicit stack, recursion
+// runs out of stack on large images. Visit order is the same as the recursive version.
+//
 void BlockMap::Scan(std::vector<ContourPoint *> &points, Block *b) {
 	if (b->IsVisited()) {
 		return;
 	}
+	// block and the next neighbour to try
+	std::vector<std::pair<Block *, int> > stack;
 	b->Visit();
-	b->Scan(points);
-
-	auto left = Left(b);
-	if ((left != NULL) && (!left->IsVisited())) {
-		Scan(points, left);
-	}
-
-	auto right = Right(b);
-	if ((right != NULL) && (!right->IsVisited())) {
-		Scan(points, right);
-	}
-
-	auto up = Up(b);
-	if ((up != NULL) && (!up->IsVisited())) {
-		Scan(points,up);
-	}
-
-	auto down = Down(b);
-	if ((down != NULL) && (!down->IsVisited())) {
-		Scan(points,down);
+	scanOrder.push_back(b);
+	numThinned += b->Scan(points);
+	stack.push_back(std::make_pair(b, 0));
+	while (!stack.empty()) {
+		Block *current = stack.back().first;
+		int dir = stack.back().second++;
+		if (dir > 3) {
+			stack.pop_back();
+			continue;
+		}
+		Block *next = (dir == 0) ? Left(current) : (dir == 1) ? Right(current) : (dir == 2) ? Up(current) : Down(current);
+		if ((next != NULL) && (!next->IsVisited())) {
+			next->Visit();
+			scanOrder.push_back(next);
+			numThinned += next->Scan(points);
+			stack.push_back(std::make_pair(next, 0));
+		}
 	}
 }
 
 std::vector<ContourPoint *> BlockMap::ExtractContourPoints()  {
 	std::vector<ContourPoint *> points;
 
-	auto it = blocks.begin();
-	while (it != blocks.end()) {
-		Block *b = it->second;
+	for (int i=0;i<grid.size();i++) {
+		Block *b = grid[i];
 		if (!b->IsVisited()) {
 			Scan(points, b);
 		}
-		it++;
 	}
 	// This can probably be done while iterating through a global variable...
 	// But let's try to avoid globals, shall we...
@@ -808,10 +1777,44 @@ std::vector<ContourPoint *> BlockMap::ExtractContourPoints()  {
 		points[i]->SetPIndex(i);
 	}
 
-	printf("ContourPoints: %d,%d\n", points.size(),i);
+	TRACE_INFO("ContourPoints: %d,%d", (int)points.size(), i);
+	if (glbConfig.Thinning) {
+		TRACE_INFO("Thinning: %d of %d points removed (%.1f%%)", numThinned, numThinned + (int)points.size(),
+			(numThinned > 0) ? (100.0f * numThinned / (numThinned + points.size())) : 0.0f);
+	}
 	return points;
 }
 
+//
+// Rescan after the luma plane was rebuilt from a frame of the same size. Only blocks whose
+// footprint changed are scanned again, the others keep their points. Points are collected in the
+// order of the initial scan, so the result is identical to a full scan of the new frame.
+// Any points still in 'points' must be reset (not used) before calling this.
+//
+void BlockMap::Rescan(std::vector<ContourPoint *> &points) {
+	std::vector<uint8_t> changed;
+	FindChangedCells(changed);
+	ScanCells();
+	MarkFlatBlocks();
+
+	int numChanged = 0;
+	points.clear();
+	for (int i=0;i<scanOrder.size();i++) {
+		Block *b = scanOrder[i];
+		if (IsChanged(changed, b->GridX(), b->GridY())) {
+			b->ClearPoints();
+			b->Scan(points);
+			numChanged++;
+		} else {
+			points.insert(points.end(), b->points.begin(), b->points.end());
+		}
+	}
+	for (int i=0;i<points.size();i++) {
+		points[i]->SetPIndex(i);
+	}
+	TRACE_INFO("Rescan, changed blocks: %d of %d, ContourPoints: %d", numChanged, (int)scanOrder.size(), (int)points.size());
+}
+
 //
 // Contour Point
 //
@@ -820,10 +1823,26 @@ ContourPoint::ContourPoint(int x, int y, Block *b) :
 	pt(x,y)
 {
 	this->pindex = -1;
+	this->bindex = -1;
 	this->block = b;
 	this->used = false;
 }
 
+void ContourPoint::Use() {
+	used = true;
+	block->MarkUsed(bindex, true);
+}
+
+void ContourPoint::ResetUsage() {
+	used = false;
+	block->MarkUsed(bindex, false);
+}
+
+void ContourPoint::SetPIndex(int idx) {
+	pindex = idx;
+	block->SetPointIndex(bindex, idx);
+}
+
 static float VecLen(Point *a, Point *b) {
 	float dx = (float)(b->X() - a->X());
 	float dy = (float)(b->Y() - a->Y());
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <math.h>
+#include <stdint.h>
 #include <map>
 #include <vector>
 
@@ -14,6 +15,13 @@ namespace gnilk {
 		class BlockMap;
 
 
+		// Contour points -> line segments
+		typedef enum {
+			kEngine_DistanceSort = 0,	// ContourCluster, nearest points around the segment start
+			kEngine_ChainCode = 1,		// ChainCodeTracer, follows 8-connected contour pixels
+			kEngine_IsoLine = 2,		// IsoLineTracer, marching squares on the grey plane, no contour points
+		} ExtractionEngine;
+
 		struct Config {
 			uint8_t GreyThresholdLevel;
 			float ClusterCutOffDistance;
@@ -21,14 +29,39 @@ namespace gnilk {
 			float LineCutOffAngle;
 			float LongLineDistance;
 			float OptimizationCutOffAngle;
-			float ContrastFactor; // NOT USED
-			float ContrastScale; // NOT USED
+			float ContrastFactor;	// grey = pow(grey, ContrastFactor) * ContrastScale, both '1' disables
+			float ContrastScale;
 			int BlockSize;
 			float FilledBlockLevel;
 			int Width;
 			int Height;
 			bool Optimize;
 			bool Verbose;
+			ExtractionEngine Engine;
+			int Downscale;	// kEngine_IsoLine, traces a 1/Downscale grey plane, iso level is GreyThresholdLevel
+			bool Thinning;	// non-maximum suppression across the edge, one point wide contours
+		};
+
+		//
+		// Packed 8-bit luma of a frame, BT.601 weights. Built once per frame, all scanning reads this.
+		//
+		class LumaPlane {
+		private:
+			int width;
+			int height;
+			std::vector<uint8_t> data;
+		public:
+			LumaPlane();
+			void FromRGBA(Bitmap *src, const uint8_t *lut = NULL);
+			void FromGrey(const uint8_t *src, int width, int height, const uint8_t *lut = NULL);
+			void Clear();
+			int Width() { return width; }
+			int Height() { return height; }
+			uint8_t *Buffer() { return data.data(); }
+			uint8_t At(int x, int y) { return data[x + y * width]; }
+			bool Inside(int x, int y) { return (x >= 0) && (x < width) && (y >= 0) && (y < height); }
+
+			static void RGBAToLuma(uint8_t *dst, const unsigned char *rgba, int n);
 		};
 
 
@@ -92,6 +125,7 @@ namespace gnilk {
 		class ContourPoint {
 		private:
 			int pindex;
+			int bindex;	// index within owning block
 			Point pt;
 			Block *block;
 			bool used;
@@ -102,10 +136,12 @@ namespace gnilk {
 			int Y() { return pt.y; }
 			Point Pt() { return pt; }
 			bool IsUsed() { return used; }
-			void Use() { used = true; }
-			void ResetUsage() { used = false; }
+			void Use();
+			void ResetUsage();
 			int PIndex() { return pindex; }
-			void SetPIndex(int idx) { pindex = idx; }
+			void SetPIndex(int idx);
+			int BIndex() { return bindex; }
+			void SetBIndex(int idx) { bindex = idx; }
 			Block *GetBlock() { return block; }
 			float Distance(ContourPoint *other);
 		};
@@ -113,15 +149,16 @@ namespace gnilk {
 		class ContourCluster {
 		private:
 			std::vector<ContourPoint *> &points;
+			std::vector<PointDistance> pds;	// scratch, reused between segments
 			BlockMap *blockmap;
 		public:
 			ContourCluster(std::vector<ContourPoint *> &points, BlockMap *map);
 			std::vector<LineSegment *> ExtractVectors();
 		private:
 			LineSegment *NextSegment(int idxStart);						
-			void CalcPointDistance(int pidx, std::vector<PointDistance *> &distances);
-			void LocalSearchPointDistance(int pidx, std::vector<PointDistance *> &distances);
-			void FullSearchPointDistance(int pidx, std::vector<PointDistance *> &distances);
+			void CalcPointDistance(int pidx, std::vector<PointDistance> &distances);
+			void LocalSearchPointDistance(int pidx, std::vector<PointDistance> &distances);
+			void FullSearchPointDistance(int pidx, std::vector<PointDistance> &distances);
 			LineSegment *NewLineSegment(int idxA, int idxB);
 			int Len() { return points.size(); }
 			ContourPoint *At(int idx) { return points[idx]; }
@@ -129,12 +166,68 @@ namespace gnilk {
 		};
 
 
+		//
+		// Walks the contour pixels as 8-connected chains (Moore neighbourhood, continuing
+		// straight ahead first) and cuts each chain with the LineCutOff rules.
+		// Every pixel is traced once, no neighbourhood sorting.
+		//
+		class ChainCodeTracer {
+		private:
+			std::vector<ContourPoint *> &points;
+			int width;
+			int height;
+			std::vector<int> pixels;	// pindex per pixel, -1 when not a contour pixel or already traced
+			std::vector<Point> polyline;	// scratch
+		public:
+			ChainCodeTracer(std::vector<ContourPoint *> &points, int width, int height);
+			std::vector<LineSegment *> ExtractVectors();
+		private:
+			int Follow(int pindex, int dir, std::vector<int> &chain);
+			int NextNeighbour(int &x, int &y, int &dir);
+			int BridgeGap(int &x, int &y, int &dir);
+			void SplitChain(std::vector<int> &chain, std::vector<LineSegment *> &lineSegments);
+		};
+
+		//
+		// Marching squares on a grey plane, follows the iso-lines and interpolates the crossing
+		// on every cell edge. Positions are scaled back to image coordinates, so a downscaled
+		// plane still gives sub-sample precision.
+		//
+		class IsoLineTracer {
+		private:
+			const std::vector<uint8_t> &plane;
+			int width;
+			int height;
+			int scale;
+			float isoLevel;
+			int numHorizontal;				// edges between horizontal neighbours, vertical edges follow
+			std::vector<int> links;			// two connected edges per crossed edge, -1 if none
+			std::vector<uint8_t> visited;
+			std::vector<Point> polyline;	// scratch
+		public:
+			IsoLineTracer(const std::vector<uint8_t> &plane, int width, int height, int scale);
+			std::vector<LineSegment *> ExtractVectors(float isoLevel);
+			static void BuildPlane(std::vector<uint8_t> &plane, int *width, int *height, LumaPlane *luma, int scale);
+		private:
+			void Link(int edgeA, int edgeB);
+			Point EdgePoint(int edge);
+			void Walk(int edge, std::vector<LineSegment *> &lineSegments);
+		};
+
 		class Block {
 		private:
-			Bitmap *bitmap;
+			LumaPlane *luma;
+			BlockMap *blockmap;
 			int x,y;
+			int index;		// linear index in the blockmap grid
+			int numLive;	// points not yet used
 			bool visited;	// during scan
 			bool extracted;	// during line extraction
+			bool flat;		// scan footprint can't exceed GreyThresholdLevel, nothing to scan
+			// SIMD friendly mirror of 'points', kept in sync by AddPoint/MarkUsed
+			std::vector<int16_t> coords;	// interleaved x,y
+			std::vector<int32_t> indices;	// pindex
+			std::vector<uint8_t> used;
 		public:
 			std::vector<ContourPoint *> points;
 
@@ -143,42 +236,78 @@ namespace gnilk {
 			int HashFunc(int x, int y);
 			uint8_t ReadGreyPixel(int x, int y);
 			float PixelAsFloat(int x, int y);
+			float EdgeStrength(int x, int y);
+			bool IsEdgeMaximum(int x, int y, float deltaX, float deltaY);
 		public:
-			Block(Bitmap *bitmap, int x, int y);
+			Block(BlockMap *blockmap, LumaPlane *luma, int x, int y, int index);
 			int Hash();
+			int Index() { return index; }
+			int GridX();
+			int GridY();
 			int Left();
 			int Right();
 			int Up();
 			int Down();
 
-			void Scan(std::vector<ContourPoint *> &pnts);
-			void CalcPointDistance(ContourPoint *cp, std::vector<PointDistance *> &distances);
+			int Scan(std::vector<ContourPoint *> &pnts);
+			void ClearPoints();
+			void AddPoint(ContourPoint *cp);
+			void SetPointIndex(int bindex, int pindex) { indices[bindex] = pindex; }
+			void MarkUsed(int bindex, bool isUsed);
+			void CalcPointDistance(ContourPoint *cp, std::vector<PointDistance> &distances);
 
 			bool IsVisited() { return visited; }
 			void Visit() { visited = true; }
 
+			bool IsFlat() { return flat; }
+			void SetFlat(bool isFlat) { flat = isFlat; }
+
 			bool IsExtracted() { return extracted; }
 			void SetExtracted() { extracted = true; }
+			void ResetExtracted() { extracted = false; }
 
 			int NumPoints() { return points.size(); }
+			int NumLive() { return numLive; }
 		};
 
 		class BlockMap {
 		private:
-			Bitmap *bitmap;
-			std::map<int, Block *> blocks;
+			LumaPlane *luma;
+			std::vector<Block *> grid;		// blocks by linear index, also the block hash
+			std::vector<uint64_t> liveBits;	// one bit per block, set while it has unused points
+			int gridWidth;
+			int gridHeight;
+			std::vector<Block *> scanOrder;	// blocks in the order they were scanned
+			// per block sized cell, the 3x3 cells around a block cover its scan footprint
+			int cellsX;
+			int cellsY;
+			std::vector<int> cellMin;
+			std::vector<int> cellMax;
+			std::vector<uint8_t> prevLuma;	// luma of the last scan, Rescan compares the cells against it
+			int numThinned;		// points removed by Config::Thinning during the initial scan
 
 			void BuildBlocks();
+			void ScanCells();
+			void MarkFlatBlocks();
+			void FindChangedCells(std::vector<uint8_t> &changed);
+			bool IsChanged(const std::vector<uint8_t> &changed, int gx, int gy);
 		public:
-			BlockMap(Bitmap *bitmap);
+			BlockMap(LumaPlane *luma);
+			virtual ~BlockMap();
 			Block *GetBlock(int hashValue);
 			Block *Left(Block *block);
 			Block *Right(Block *block);
 			Block *Up(Block *block);
 			Block *Down(Block *block);
+			Block *GetLiveBlock(int gx, int gy);
+			void SetLive(Block *block, bool live);
 			Block *GetBlockForExtraction(Block *previous = NULL);
 			void Scan(std::vector<ContourPoint *> &points, Block *b);
-			int NumBlocks() { return blocks.size(); }
+			void ResetExtraction();
+			void Rescan(std::vector<ContourPoint *> &points);
+			int NumBlocks() { return grid.size(); }
+			int GridWidth() { return gridWidth; }
+			int GridHeight() { return gridHeight; }
 			std::vector<ContourPoint *> ExtractContourPoints();
 		private:
 			Block *GetBlockForExtractionRecursive(Block *previous);
@@ -187,21 +316,77 @@ namespace gnilk {
 
 
 		class Trace {
+		public:
+			// Processing stages, each stage only depends on the output of the previous one
+			typedef enum {
+				kStage_Scan = 0,		// bitmap -> luma -> contour points or grey plane, depends on GreyThresholdLevel, BlockSize, Downscale, Thinning, Contrast
+				kStage_Extract = 1,		// contour points -> line segments, depends on Cluster/Line cut-offs, LongLineDistance and Engine
+				kStage_Optimize = 2,	// line segments -> optimized segments, depends on OptimizationCutOffAngle
+				kStage_Done = 3,		// nothing to recompute
+			} Stage;
 		private:
 			int intermediateWidth;
 			int intermediateHeight;
+			Config config;
+			Stage dirtyStage;
+			bool rescanBlocks;		// scan stage only re-scans changed blocks, set by SetFrame
+
+			// Cached stage output, freed when the stage is invalidated
+			Bitmap *bitmap;
+			LumaPlane grey;				// grey input frame, used instead of 'bitmap' when there is none
+			LumaPlane luma;				// contrast adjusted luma of 'bitmap' or 'grey', input of the scan
+			BlockMap *blockmap;
+			std::vector<ContourPoint *> points;
+			std::vector<uint8_t> plane;		// kEngine_IsoLine instead of points
+			int planeWidth;
+			int planeHeight;
+			std::vector<LineSegment *> lineSegments;
+			std::vector<Strip *> strips;
+			std::vector<LineSegment *> optSegments;
+			std::vector<Strip *> optStrips;
+
 			void SetDefaultConfig();
+			void BuildLuma();
 		public:
 			Trace();
+			virtual ~Trace();
+			static Config DefaultConfig();
 			void ProcessImage(unsigned char *data, int width, int height);
+
+			// Incremental interface, Update only recomputes stages invalidated by SetImage/SetConfig
+			Config GetConfig() { return config; }
+			void SetConfig(const Config &newConfig);
+			void SetImage(unsigned char *data, int width, int height);
+			void SetFrame(unsigned char *data, int width, int height);
+			// 8-bit grey input (one byte per pixel), goes straight to the luma plane
+			void SetGreyImage(const uint8_t *data, int width, int height);
+			void SetGreyFrame(const uint8_t *data, int width, int height);
+			Stage Update();
+
+			std::vector<ContourPoint *> &ContourPoints() { return points; }
+			std::vector<LineSegment *> &LineSegments() { return lineSegments; }
+			std::vector<Strip *> &Strips() { return strips; }
+			std::vector<LineSegment *> &OptimizedSegments() { return optSegments; }
+			std::vector<Strip *> &OptimizedStrips() { return optStrips; }
+
+			Bitmap *DrawLineSegments(std::vector<LineSegment *> &lineSegments);
+			Bitmap *DrawCluster(std::vector<ContourPoint *> &points);
+
+			static Stage FirstChangedStage(const Config &a, const Config &b);
+			static bool HasContrast(const Config &config);
+			static void BuildContrastLut(uint8_t *lut, float factor, float scale);
+			static void SerializeStrips(std::string &out, std::vector<Strip *> &strips);
+			// Connected segments to strips, a start point closer than 2 to the previous strip point is dropped
+			static int LineSegmentsToStrips(std::vector<Strip *> &strips, std::vector<LineSegment *> &lineSegments);
 		private:
+			void Invalidate(Stage stage);
+			void ClearStage(Stage stage);
+			void RunStage(Stage stage);
+
 			void OptimizeLineSegments(std::vector<LineSegment *> &newSegments, std::vector<LineSegment *> &lineSegments);
 			void RescaleLineSegments(std::vector<LineSegment *> &lineSegments, int w, int h);
-			int LineSegmentsToStrips(std::vector<Strip *> &strips, std::vector<LineSegment *> &lineSegments);
 			void DumpStrips(const char *title, std::vector<Strip *> &strips);
 			void WriteStrips(std::string filename, std::vector<Strip *> &strips);
-			Bitmap *DrawLineSegments(std::vector<LineSegment *> &lineSegments);
-			Bitmap *DrawCluster(std::vector<ContourPoint *> &points);
 			void DrawLine(Bitmap *dst, Point a, Point b, uint8_t cr, uint8_t cg, uint8_t cb);
 		};
 
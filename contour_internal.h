@@ -1,5 +1,8 @@
 #pragma once
 
+#include <math.h>
+#include <vector>
+
 namespace gnilk {
 	namespace contour {
 
@@ -27,20 +30,26 @@ namespace gnilk {
 			}
 		};
 
+		// Squared distance to a point, the square root is only taken when asked for
 		class PointDistance {
 		private:
-			float distance;
+			int distance2;
 			int pindex;
 		public:
-			PointDistance(float d, int idx) {
-				distance = d;
+			PointDistance() {
+				distance2 = 0;
+				pindex = -1;
+			}
+			PointDistance(int d2, int idx) {
+				distance2 = d2;
 				pindex = idx;
 			}
 
-			float Distance() { return distance; }
+			float Distance() { return sqrtf((float)distance2); }
+			int Distance2() { return distance2; }
 			int PIndex() { return pindex; }
-			static bool Less(PointDistance *a, PointDistance *b) {
-				return (a->distance < b->distance);
+			static bool Less(const PointDistance &a, const PointDistance &b) {
+				return (a.distance2 < b.distance2);
 			}
 		};
 
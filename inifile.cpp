@@ -1,5 +1,6 @@
 #include <string>
-#include <map>
+#include <ctype.h>
+#include <algorithm>
 
 #include "logger.h"
 #include "tokenizer.h"
@@ -7,21 +8,25 @@
 
 using namespace gnilk::inifile;
 
-class IniFileParser {
-public:
-	static void FromBuffer(SectionContainer *container, std::string data);
+namespace gnilk {
+	namespace inifile {
+		class IniFileParser {
+		public:
+			static void FromBuffer(SectionContainer *container, const StringRef &data);
+		};
+	};
 };
 
-// Note: this is just a hack!
-void IniFileParser::FromBuffer(SectionContainer *container, std::string data) {
-	//SectionContainer *container = new SectionContainer();
-	const char *pdata = data.c_str();
-	char *pc = (char *)&pdata[0];
-	int tc = 0;
-	char token[256];	// MAX TOKEN
-	std::string sectionName;
-	std::string valueName;
-	std::string value;
+//
+// Single pass over the buffer, section/name/value are stored as references into the
+// buffer so nothing is copied. The section is looked up once per section header.
+//
+void IniFileParser::FromBuffer(SectionContainer *container, const StringRef &data) {
+	const char *pc = data.ptr;
+	const char *pend = data.ptr + data.len;
+	const char *tokStart = pc;
+	Section *section = NULL;
+	StringRef valueName;
 	int state = 0;
 
 	typedef enum {
@@ -34,129 +39,150 @@ void IniFileParser::FromBuffer(SectionContainer *container, std::string data) {
 
 	state = kParseState_ExpectSectionStart;
 
-	while(*pc != '\0') {
+	while(pc < pend) {
 		switch(state) {
 			case kParseState_ExpectSectionStart :	// expect section start
 				if (*pc == '[') {
 					state = kParseState_SectionName;
-					tc = 0;
+					tokStart = pc + 1;
 				}
 				break;
 			case kParseState_SectionName :	// parse section name
 				if (*pc == ']') {
 					state = kParseState_ExpectSectionOrNameStart;
-					token[tc] = '\0';
-					sectionName = std::string(token);
-					tc = 0;
-				} else {
-					token[tc++] = *pc;
+					section = container->GetOrCreateSection(StringRef(tokStart, pc - tokStart));
 				}
 				break;
 			case kParseState_ExpectSectionOrNameStart :  // drop white space after section name
 				if (*pc == '[') {
 					state = kParseState_SectionName;
-					tc = 0;
-				} else if (!isspace(*pc)) {
+					tokStart = pc + 1;
+				} else if (!isspace((unsigned char)*pc)) {
 					state = kParseState_ValueName;
-					token[tc++] = *pc;
+					tokStart = pc;
 				}
 				break;
 			case kParseState_ValueName : // parse value name
 				if (*pc == '=') {
 					state = kParseState_Value;
-					token[tc] = '\0';
-					valueName = std::string(token);
-					tc = 0;
-				} 	else {
-					token[tc++] = *pc;					
+					valueName = StringRef(tokStart, pc - tokStart);
+					tokStart = pc + 1;
 				}
 				break;
-			case kParseState_Value : // parse value
-				if (*pc == '\n') {
+			case kParseState_Value : // parse value, runs to end of line
+				{
+					const char *eol = (const char *)memchr(pc, '\n', pend - pc);
+					if (eol == NULL) {
+						pc = pend;
+						continue;
+					}
+					pc = eol;
 					state = kParseState_ExpectSectionOrNameStart;
-					token[tc] = '\0';
-					value = std::string(token);
-					tc = 0;
-
-					container->SetValue(sectionName, valueName, value);
-					// Logger::GetLogger("IniFileParser")->Debug("SetValue(%s,%s,%s)",
-					// 	sectionName.c_str(),
-					// 	valueName.c_str(),
-					// 	value.c_str());
-
-				} else {
-					token[tc++] = *pc;
+					section->SetValue(valueName, StringRef(tokStart, pc - tokStart));
 				}
 				break;
  		}
 		pc++;
 	}
 	if (state == kParseState_Value) {
-		container->SetValue(sectionName, valueName, value);
-		// Logger::GetLogger("IniFileParser")->Debug("SetValue(%s,%s,%s)",
-		// 	sectionName.c_str(),
-		// 	valueName.c_str(),
-		// 	value.c_str());		
+		section->SetValue(valueName, StringRef(tokStart, pend - tokStart));
 	}
 
 }
 
+//
+// FNV-1a
+//
+size_t StringRefHash::operator()(const StringRef &str) const {
+	size_t hash = 2166136261u;
+	for(size_t i=0;i<str.len;i++) {
+		hash ^= (unsigned char)str.ptr[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
 // --> section container
 SectionContainer::SectionContainer() {
 
 }
 SectionContainer::~SectionContainer() {
+	for(auto it=sectionList.begin(); it != sectionList.end(); it++) {
+		delete *it;
+	}
+}
 
+void SectionContainer::FromBuffer(const std::string &buffer) {
+	return IniFileParser::FromBuffer(this, Store(buffer));
 }
 
-void SectionContainer::FromBuffer(std::string buffer) {
-	return IniFileParser::FromBuffer(this, buffer);
+// Takes ownership of the buffer, avoids the copy
+void SectionContainer::FromBuffer(std::string &&buffer) {
+	storage.push_back(std::move(buffer));
+	return IniFileParser::FromBuffer(this, StringRef(storage.back()));
 }
-void SectionContainer::SetValue(std::string section, std::string name, std::string value) {
-	auto it = sections.find(section);
-	if (it == sections.end()) {
-		Section *s = new Section(section);
-		s->SetValue(name, value);
-		sections.insert(std::make_pair(section, s));
-	} else {
-		it->second->SetValue(name, value);
+
+// Strings in the deque never move, so references to them stay valid
+const StringRef SectionContainer::Store(const std::string &str) {
+	storage.push_back(str);
+	return StringRef(storage.back());
+}
+
+void SectionContainer::SetValue(const std::string &section, const std::string &name, const std::string &value) {
+	Section *s = GetSection(section);
+	if (s == NULL) {
+		s = GetOrCreateSection(Store(section));
+	}
+	StringRef refName(name);
+	if (!s->HasValue(refName)) {
+		refName = Store(name);
 	}
+	s->SetValue(refName, Store(value));
 }
-bool SectionContainer::HasValue(std::string section, std::string name) {
-	auto it = sections.find(section);
-	if (it == sections.end()) {
+bool SectionContainer::HasValue(const StringRef &section, const StringRef &name) {
+	Section *s = GetSection(section);
+	if (s == NULL) {
 		return false;
 	}
-	return it->second->HasValue(name);
+	return s->HasValue(name);
 }
 
-std::string SectionContainer::GetValue(std::string section, std::string name, std::string defaultValue) {
-	auto it = sections.find(section);
-	if (it == sections.end()) {
+bool SectionContainer::GetValue(const StringRef &section, const StringRef &name, StringRef &outValue) {
+	Section *s = GetSection(section);
+	if (s == NULL) {
+		return false;
+	}
+	return s->GetValue(name, outValue);
+}
+
+std::string SectionContainer::GetValue(const StringRef &section, const StringRef &name, const std::string &defaultValue) {
+	Section *s = GetSection(section);
+	if (s == NULL) {
 		return defaultValue;
 	}
-	return it->second->GetValue(name, defaultValue);
+	return s->GetValue(name, defaultValue);
 
 }
 
-bool SectionContainer::DeleteValue(std::string section, std::string name) {
+bool SectionContainer::DeleteValue(const StringRef &section, const StringRef &name) {
 	Section *s = GetSection(section);
 	if (s == NULL) return false;
 	return s->DeleteValue(name);
 }
 
-bool SectionContainer::DeleteSection(std::string section) {
+bool SectionContainer::DeleteSection(const StringRef &section) {
 	auto it = sections.find(section);
 	if (it == sections.end()) {
 		return false;
 	}
 	Section *s = it->second;
 	sections.erase(it);
+	sectionList.erase(std::find(sectionList.begin(), sectionList.end(), s));
 	delete s;
 	return true;
 }
 
-Section *SectionContainer::GetSection(std::string section) {
+Section *SectionContainer::GetSection(const StringRef &section) {
 	auto it = sections.find(section);
 	if (it == sections.end()) {
 		return NULL;
@@ -164,15 +190,33 @@ Section *SectionContainer::GetSection(std::string section) {
 	return it->second;
 }
 
+// Note: 'section' must point to storage owned by the container
+Section *SectionContainer::GetOrCreateSection(const StringRef &section) {
+	Section *s = GetSection(section);
+	if (s == NULL) {
+		s = new Section(section);
+		sections.insert(std::make_pair(section, s));
+		sectionList.push_back(s);
+	}
+	return s;
+}
+
+// Section names in file order
+void SectionContainer::GetSectionNames(std::vector<std::string> &names) {
+	for(auto it=sectionList.begin(); it != sectionList.end(); it++) {
+		names.push_back((*it)->Name());
+	}
+}
+
 void SectionContainer::Dump(std::string &out) {
-	for(auto it=sections.begin(); it != sections.end(); it++) {
-		it->second->Dump(out);
+	for(auto it=sectionList.begin(); it != sectionList.end(); it++) {
+		(*it)->Dump(out);
 	}
 }
 
 
 // --> section
-Section::Section(std::string name) {
+Section::Section(const StringRef &name) {
 	this->name = name;
 }
 
@@ -180,49 +224,73 @@ Section::~Section() {
 
 }
 
-void Section::SetValue(std::string name, std::string value) {
-	auto it = values.find(name);
-	if (it == values.end()) {
-		values.insert(std::make_pair(name, value));
-	} else {
-		// replace
-		it->second = value;		
+int Section::FindValue(const StringRef &name) {
+	if (index.empty()) {
+		for(size_t i=0;i<values.size();i++) {
+			if (values[i].first == name) return (int)i;
+		}
+		return -1;
 	}
+	auto it = index.find(name);
+	return (it == index.end()) ? -1 : (int)it->second;
 }
 
-bool Section::HasValue(std::string name) {
-	auto it = values.find(name);
-	if (it == values.end()) {
-		return false;
+void Section::SetValue(const StringRef &name, const StringRef &value) {
+	int idx = FindValue(name);
+	if (idx < 0) {
+		values.push_back(std::make_pair(name, value));
+		if (!index.empty()) {
+			index.insert(std::make_pair(name, values.size()-1));
+		} else if (values.size() > kMaxLinearValues) {
+			for(size_t i=0;i<values.size();i++) index.insert(std::make_pair(values[i].first, i));
+		}
+	} else {
+		values[idx].second = value;
 	}
+}
+
+bool Section::HasValue(const StringRef &name) {
+	return (FindValue(name) >= 0);
+}
+
+bool Section::GetValue(const StringRef &name, StringRef &outValue) {
+	int idx = FindValue(name);
+	if (idx < 0) return false;
+	outValue = values[idx].second;
 	return true;
 }
 
-std::string Section::GetValue(std::string name, std::string defaultValue) {
-	auto it = values.find(name);
-	if (it == values.end()) {
-		return defaultValue;
-	}
-	return it->second;
+std::string Section::GetValue(const StringRef &name, const std::string &defaultValue) {
+	int idx = FindValue(name);
+	if (idx < 0) return defaultValue;
+	return values[idx].second.ToString();
 }
-bool Section::DeleteValue(std::string name) {
-	auto it = values.find(name);
-	if (it == values.end()) return false;
-	values.erase(it);
+
+// Moves the last value into the hole, dump order changes but nothing else has to be re-indexed
+bool Section::DeleteValue(const StringRef &name) {
+	int idx = FindValue(name);
+	if (idx < 0) return false;
+	index.erase(name);
+	if (idx != (int)values.size() - 1) {
+		values[idx] = values.back();
+		if (!index.empty()) index[values[idx].first] = idx;
+	}
+	values.pop_back();
 	return true;
 }
 
 std::string Section::Name() {
-	return name;
+	return name.ToString();
 }
 
-#define SEC_BEGIN (std::string("["))
-#define SEC_END (std::string("]"))
-#define VAL_SEP (std::string("="))
-
 void Section::Dump(std::string &out) {
-	out.append(SEC_BEGIN + name + SEC_END + std::string("\n"));
+	out.append("[");
+	out.append(name.ptr, name.len);
+	out.append("]\n");
 	for(auto it = values.begin(); it != values.end(); it++) {
-		out.append(it->first + VAL_SEP + it->second);
+		out.append(it->first.ptr, it->first.len);
+		out.append("=");
+		out.append(it->second.ptr, it->second.len);
+		out.append("\n");
 	}
 }
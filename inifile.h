@@ -1,11 +1,38 @@
 #pragma once
-#include <map>
+#include <stddef.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <unordered_map>
 #define DEFAULT_PROP_SEPARATORS ((char*)("= [ ]"))
 
 
 namespace gnilk {
 	namespace inifile {
 
+		//
+		// Non-owning string, points into a buffer owned by the SectionContainer
+		//
+		struct StringRef {
+			const char *ptr;
+			size_t len;
+
+			StringRef() : ptr(""), len(0) {}
+			StringRef(const char *ptr, size_t len) : ptr(ptr), len(len) {}
+			StringRef(const char *str) : ptr(str), len(strlen(str)) {}
+			StringRef(const std::string &str) : ptr(str.c_str()), len(str.length()) {}
+
+			std::string ToString() const { return std::string(ptr, len); }
+			bool operator == (const StringRef &other) const {
+				return (len == other.len) && (memcmp(ptr, other.ptr, len) == 0);
+			}
+		};
+
+		struct StringRefHash {
+			size_t operator()(const StringRef &str) const;
+		};
+
 		class Section;
 
 		class SectionContainer {
@@ -13,32 +40,47 @@ namespace gnilk {
 			SectionContainer();
 			virtual ~SectionContainer();
 
-			void FromBuffer(std::string buffer);
-			void SetValue(std::string section, std::string name, std::string value);
-			bool HasValue(std::string section, std::string name);
-			std::string GetValue(std::string section, std::string name, std::string defaultValue);
-			bool DeleteValue(std::string section, std::string name);
-			bool DeleteSection(std::string section);
+			void FromBuffer(const std::string &buffer);
+			void FromBuffer(std::string &&buffer);
+			void SetValue(const std::string &section, const std::string &name, const std::string &value);
+			bool HasValue(const StringRef &section, const StringRef &name);
+			bool GetValue(const StringRef &section, const StringRef &name, StringRef &outValue);
+			std::string GetValue(const StringRef &section, const StringRef &name, const std::string &defaultValue);
+			bool DeleteValue(const StringRef &section, const StringRef &name);
+			bool DeleteSection(const StringRef &section);
+			void GetSectionNames(std::vector<std::string> &names);
 			void Dump(std::string &out);
 		private:
-			Section *GetSection(std::string section);
-			std::map<std::string, Section *> sections;
+			friend class IniFileParser;
+			const StringRef Store(const std::string &str);
+			Section *GetSection(const StringRef &section);
+			Section *GetOrCreateSection(const StringRef &section);
+			// Parsed buffers and strings from SetValue, all StringRef's point in here
+			std::deque<std::string> storage;
+			std::vector<Section *> sectionList;
+			std::unordered_map<StringRef, Section *, StringRefHash> sections;
 		};
 
 		class Section {
 		public:
-			Section(std::string name);
+			Section(const StringRef &name);
 			virtual ~Section();
 
-			void SetValue(std::string name, std::string value);
-			bool HasValue(std::string name);
-			std::string GetValue(std::string name, std::string defaultValue);
-			bool DeleteValue(std::string name);
+			void SetValue(const StringRef &name, const StringRef &value);
+			bool HasValue(const StringRef &name);
+			bool GetValue(const StringRef &name, StringRef &outValue);
+			std::string GetValue(const StringRef &name, const std::string &defaultValue);
+			bool DeleteValue(const StringRef &name);
 			std::string Name();
 			void Dump(std::string &out);
 		private:
-			std::string name;
-			std::map<std::string, std::string> values;
+			static const size_t kMaxLinearValues = 16;
+			int FindValue(const StringRef &name);
+			StringRef name;
+			// values in file order, small sections are scanned linearly and the
+			// hash index is only built once a section grows past kMaxLinearValues
+			std::vector<std::pair<StringRef, StringRef> > values;
+			std::unordered_map<StringRef, size_t, StringRefHash> index;
 		};
 	};
-};
\ No newline at end of file
+};
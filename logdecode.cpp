@@ -0,0 +1,188 @@
+//
+// Decoder for binary log files written by LogBinaryFileSink
+//
+// Usage: logdecode [-csv] <logfile>
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "logger.h"
+#include "logrecord.h"
+
+using namespace gnilk;
+
+static std::map<int, std::string> loggerNames;
+static std::map<int, std::string> eventNames;
+static std::map<int, std::vector<std::string> > eventArgNames;
+
+static bool ReadString(FILE *f, std::string &dst) {
+	uint16_t len;
+	if (fread(&len, sizeof(len), 1, f) != 1) {
+		return false;
+	}
+	dst.resize(len);
+	if ((len > 0) && (fread(&dst[0], 1, len, f) != len)) {
+		return false;
+	}
+	return true;
+}
+
+static void SplitArgNames(const std::string &argNames, std::vector<std::string> &dst) {
+	size_t pos = 0;
+	while (pos <= argNames.length()) {
+		size_t next = argNames.find(',', pos);
+		if (next == std::string::npos) {
+			next = argNames.length();
+		}
+		if (next > pos) {
+			dst.push_back(argNames.substr(pos, next - pos));
+		}
+		pos = next + 1;
+	}
+}
+
+static std::string LoggerName(int id) {
+	if (loggerNames.find(id) == loggerNames.end()) {
+		char tmp[32];
+		snprintf(tmp, 32, "logger_%d", id);
+		return std::string(tmp);
+	}
+	return loggerNames[id];
+}
+
+static std::string EventName(int id) {
+	if (eventNames.find(id) == eventNames.end()) {
+		char tmp[32];
+		snprintf(tmp, 32, "event_%d", id);
+		return std::string(tmp);
+	}
+	return eventNames[id];
+}
+
+static void PrintRecord(const LogBinaryRecord &record, bool csv) {
+	std::string logger = LoggerName(record.loggerId);
+	std::string event = EventName(record.eventId);
+	const char *level = Logger::MessageClassNameFromInt(record.level);
+
+	if (csv) {
+		printf("%llu,%s,%s,%s", (unsigned long long)record.timestamp, logger.c_str(), level, event.c_str());
+		for (int i=0;i<LOG_BINARY_MAX_ARGS;i++) {
+			if (i < record.numArgs) {
+				printf(",%g", record.args[i]);
+			} else {
+				printf(",");
+			}
+		}
+		printf("\n");
+		return;
+	}
+
+	// Same time layout as the text sinks
+	time_t tsec = (time_t)(record.timestamp / 1000000);
+	int msec = (int)((record.timestamp % 1000000) / 1000);
+	struct tm gmt;
+	gmtime_r(&tsec, &gmt);
+	printf("%.2d.%.2d.%.4d %.2d:%.2d:%.2d.%.3d %8s %32s - %s",
+		gmt.tm_mday, gmt.tm_mon + 1, gmt.tm_year + 1900,
+		gmt.tm_hour, gmt.tm_min, gmt.tm_sec, msec,
+		level, logger.c_str(), event.c_str());
+
+	std::vector<std::string> &argNames = eventArgNames[record.eventId];
+	for (int i=0;i<record.numArgs;i++) {
+		if (i < argNames.size()) {
+			printf(" %s=%g", argNames[i].c_str(), record.args[i]);
+		} else {
+			printf(" %g", record.args[i]);
+		}
+	}
+	printf("\n");
+}
+
+int main(int argc, char **argv) {
+	bool csv = false;
+	char *filename = NULL;
+	for (int i=1;i<argc;i++) {
+		if (!strcmp(argv[i], "-csv")) {
+			csv = true;
+		} else {
+			filename = argv[i];
+		}
+	}
+	if (filename == NULL) {
+		printf("Usage: logdecode [-csv] <logfile>\n");
+		exit(1);
+	}
+
+	FILE *f = fopen(filename, "rb");
+	if (f == NULL) {
+		perror("Unable to open log file");
+		exit(1);
+	}
+
+	LogBinaryHeader header;
+	if ((fread(&header, sizeof(header), 1, f) != 1) || (header.magic != LOG_BINARY_MAGIC)) {
+		printf("ERROR: '%s' is not a binary log file\n", filename);
+		exit(1);
+	}
+	if (header.version != LOG_BINARY_VERSION) {
+		printf("ERROR: Unsupported version %d\n", header.version);
+		exit(1);
+	}
+
+	if (csv) {
+		printf("timestamp,logger,level,event");
+		for (int i=0;i<LOG_BINARY_MAX_ARGS;i++) {
+			printf(",arg%d", i);
+		}
+		printf("\n");
+	}
+
+	int numRecords = 0;
+	uint8_t type;
+	while (fread(&type, 1, 1, f) == 1) {
+		uint16_t id;
+		std::string name, argNames;
+		LogBinaryRecord record;
+		switch(type) {
+			case kLogEntry_Logger :
+				if ((fread(&id, sizeof(id), 1, f) != 1) || !ReadString(f, name)) {
+					goto truncated;
+				}
+				loggerNames[id] = name;
+				break;
+			case kLogEntry_Event :
+				if ((fread(&id, sizeof(id), 1, f) != 1) || !ReadString(f, name) || !ReadString(f, argNames)) {
+					goto truncated;
+				}
+				eventNames[id] = name;
+				eventArgNames[id].clear();
+				SplitArgNames(argNames, eventArgNames[id]);
+				break;
+			case kLogEntry_Record :
+				if (fread(&record, sizeof(record), 1, f) != 1) {
+					goto truncated;
+				}
+				PrintRecord(record, csv);
+				numRecords++;
+				break;
+			default:
+				fprintf(stderr, "ERROR: Unknown entry type %d, file corrupt\n", type);
+				fclose(f);
+				exit(1);
+		}
+	}
+	fclose(f);
+	fprintf(stderr, "Records: %d\n", numRecords);
+	return 0;
+
+truncated:
+	fprintf(stderr, "WARNING: File truncated after %d records\n", numRecords);
+	fclose(f);
+	return 0;
+}
@@ -28,7 +28,7 @@
    ! Introduce more debug levels to reduce noise
    - Support for module exclusion/inclusion lists
    ! Rolling file appender would be nice!
-   - Support for threading
+   + Support for threading, async sink thread
    - Unicode support...
    - Refactor the configuration handling to optional free-standing 'LogManager' class
  </pre>
@@ -52,6 +52,7 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <string.h>
 #include <stdarg.h>
 
@@ -77,6 +78,9 @@
 
 #include <list>
 #include <map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 
 #include "logger.h"
@@ -106,6 +110,7 @@ namespace gnilk
 		"LogConsoleSink", LogConsoleSink::CreateInstance,
 		"LogRollingFileSink", LogRollingFileSink::CreateInstance,
 		"LogFileSink", LogFileSink::CreateInstance,
+		"LogBufferedFileSink", LogBufferedFileSink::CreateInstance,
 		NULL, NULL,
 	};
 
@@ -229,7 +234,7 @@ int LogFileSink::WriteLine(int dbgLevel, char *hdr, char *string)
 	{
 		if (WithinRange(dbgLevel))
 		{
-			res = fprintf(fOut,"%s%s",hdr,string);
+			res = fprintf(fOut,"%s%s\n",hdr,string);
 			if (res < 0) {
 				res = SINK_WRITE_IO_ERROR;
 			}
@@ -303,6 +308,7 @@ void LogRollingFileSink::RollOver()
 	MoveFile(srcFileName, dstFileName);
 #endif
 #else
+		rename(srcFileName, dstFileName);
 #endif
 	}
 	// 3) Open up new file
@@ -352,6 +358,248 @@ int LogRollingFileSink::WriteLine(int dbgLevel, char *hdr, char *string)
 }
 
 
+// --------------------------------------------------------------------------
+//
+// Buffered rolling file sink
+//
+#define LOG_BUFFERED_SIZE LOG_SZ_KB(256)
+#define LOG_BUFFERED_FLUSH_INTERVAL 1
+
+static std::list<LogBufferedFileSink *> bufferedSinks;
+
+LogBufferedFileSink::LogBufferedFileSink() : LogFileSink()
+{
+	szBuffer = LOG_BUFFERED_SIZE;
+	buffer = (char *)malloc(szBuffer);
+	nBuffered = 0;
+	nBytes = 0;
+	nBytesRollLimit = 0;
+	nMaxBackupIndex = 0;
+	tFirstPending = 0;
+	flushInterval = LOG_BUFFERED_FLUSH_INTERVAL;
+
+	// Sinks are normally never closed, make sure pending data reaches the file
+	if (bufferedSinks.empty()) {
+		atexit(LogBufferedFileSink::FlushAtExit);
+	}
+	bufferedSinks.push_back(this);
+}
+LogBufferedFileSink::~LogBufferedFileSink()
+{
+	Close();
+	bufferedSinks.remove(this);
+	free(buffer);
+}
+ILogOutputSink *LogBufferedFileSink::CreateInstance(const char *className)
+{
+	return dynamic_cast<ILogOutputSink *>(new LogBufferedFileSink());
+}
+
+void LogBufferedFileSink::FlushAtExit()
+{
+	for (std::list<LogBufferedFileSink *>::iterator it = bufferedSinks.begin(); it != bufferedSinks.end(); it++) {
+		(*it)->Flush();
+	}
+}
+
+char *LogBufferedFileSink::GetFileName(char *dst, int idx)
+{
+	const char *sFileName = properties.GetLogfileName();
+	snprintf(dst, LOG_MAX_FILENAME, "%s.%d.log",sFileName, idx);
+	return dst;
+}
+
+void LogBufferedFileSink::Initialize(int argc, char **argv)
+{
+	char tmp[LOG_MAX_FILENAME];
+	ParseArgs(argc, argv);
+	GetFileName(tmp, 1);
+	Open(tmp, true);
+
+	// Only time we ask the file system, from here on the size is tracked
+	nBytes = Size();
+	if (nBytes < 0) nBytes = 0;
+
+	nBytesRollLimit = properties.GetMaxLogfileSize();
+	if (!nBytesRollLimit) nBytesRollLimit = LOG_SZ_MB(10);
+	nMaxBackupIndex = properties.GetMaxBackupIndex();
+}
+
+int LogBufferedFileSink::WriteLine(int dbgLevel, char *hdr, char *string)
+{
+	if (fOut == NULL) {
+		return SINK_WRITE_IO_ERROR;
+	}
+	if (!WithinRange(dbgLevel)) {
+		return SINK_WRITE_FILTERED;
+	}
+
+	long lenHdr = strlen(hdr);
+	long lenString = strlen(string);
+	long len = lenHdr + lenString + 1;
+
+	if ((nBytes + len) > nBytesRollLimit) {
+		RollOver();
+	}
+	time_t tNow = time(NULL);
+	if ((nBuffered > 0) && ((tNow - tFirstPending) >= flushInterval)) {
+		Flush();
+	}
+	if (nBuffered == 0) {
+		tFirstPending = tNow;
+	}
+	Append(hdr, lenHdr);
+	Append(string, lenString);
+	Append("\n", 1);
+	nBytes += len;
+	return (int)len;
+}
+
+void LogBufferedFileSink::Append(const char *data, long len)
+{
+	if ((nBuffered + len) > szBuffer) {
+		Flush();
+		if (len > szBuffer) {
+			// Would not fit anyway, write straight through
+			fwrite(data, 1, len, fOut);
+			return;
+		}
+	}
+	memcpy(&buffer[nBuffered], data, len);
+	nBuffered += len;
+}
+
+void LogBufferedFileSink::Flush()
+{
+	if ((nBuffered > 0) && (fOut != NULL)) {
+		fwrite(buffer, 1, nBuffered, fOut);
+		fflush(fOut);
+	}
+	nBuffered = 0;
+}
+
+void LogBufferedFileSink::RollOver()
+{
+	char dstFileName[LOG_MAX_FILENAME];
+	char srcFileName[LOG_MAX_FILENAME];
+
+	Flush();
+	LogFileSink::Close();
+	for(int i=nMaxBackupIndex-1;i>0;i--)
+	{
+		GetFileName(srcFileName, i);
+		GetFileName(dstFileName, i+1);
+		rename(srcFileName, dstFileName);
+	}
+	GetFileName(srcFileName, 1);
+	LogFileSink::Open(srcFileName, false);
+	nBytes = 0;
+}
+
+void LogBufferedFileSink::Close()
+{
+	Flush();
+	LogFileSink::Close();
+}
+
+// --------------------------------------------------------------------------
+//
+// Binary record sink
+//
+#define LOG_BINARY_BUFFER_SIZE LOG_SZ_KB(256)
+
+LogBinaryFileSink::LogBinaryFileSink()
+{
+	fOut = NULL;
+	buffer = NULL;
+}
+LogBinaryFileSink::~LogBinaryFileSink()
+{
+	Close();
+}
+
+bool LogBinaryFileSink::Open(const char *filename)
+{
+	fOut = fopen(filename, "wb");
+	if (fOut == NULL) {
+		return false;
+	}
+	buffer = (char *)malloc(LOG_BINARY_BUFFER_SIZE);
+	setvbuf(fOut, buffer, _IOFBF, LOG_BINARY_BUFFER_SIZE);
+
+	LogBinaryHeader header;
+	header.magic = LOG_BINARY_MAGIC;
+	header.version = LOG_BINARY_VERSION;
+	fwrite(&header, sizeof(header), 1, fOut);
+	return true;
+}
+
+void LogBinaryFileSink::WriteString(const char *str)
+{
+	uint16_t len = (uint16_t)strlen(str);
+	fwrite(&len, sizeof(len), 1, fOut);
+	fwrite(str, 1, len, fOut);
+}
+
+void LogBinaryFileSink::WriteLoggerName(ILogger *pLogger)
+{
+	uint8_t type = kLogEntry_Logger;
+	uint16_t id = (uint16_t)pLogger->GetId();
+	fwrite(&type, 1, 1, fOut);
+	fwrite(&id, sizeof(id), 1, fOut);
+	WriteString(pLogger->GetName());
+}
+
+void LogBinaryFileSink::WriteEventInfo(int eventId)
+{
+	std::string name, argNames;
+	if (!Logger::GetEventInfo(eventId, name, argNames)) {
+		return;
+	}
+	uint8_t type = kLogEntry_Event;
+	uint16_t id = (uint16_t)eventId;
+	fwrite(&type, 1, 1, fOut);
+	fwrite(&id, sizeof(id), 1, fOut);
+	WriteString(name.c_str());
+	WriteString(argNames.c_str());
+}
+
+void LogBinaryFileSink::WriteRecord(ILogger *pLogger, const LogBinaryRecord *record)
+{
+	if (fOut == NULL) {
+		return;
+	}
+	if (record->loggerId >= loggersWritten.size()) {
+		loggersWritten.resize(record->loggerId + 1, false);
+	}
+	if (!loggersWritten[record->loggerId]) {
+		WriteLoggerName(pLogger);
+		loggersWritten[record->loggerId] = true;
+	}
+	if (record->eventId >= eventsWritten.size()) {
+		eventsWritten.resize(record->eventId + 1, false);
+	}
+	if (!eventsWritten[record->eventId]) {
+		WriteEventInfo(record->eventId);
+		eventsWritten[record->eventId] = true;
+	}
+	uint8_t type = kLogEntry_Record;
+	fwrite(&type, 1, 1, fOut);
+	fwrite(record, sizeof(LogBinaryRecord), 1, fOut);
+}
+
+void LogBinaryFileSink::Close()
+{
+	if (fOut != NULL) {
+		fclose(fOut);
+	}
+	fOut = NULL;
+	if (buffer != NULL) {
+		free(buffer);
+	}
+	buffer = NULL;
+}
+
 /////////
 //
 // -- static functions
@@ -359,12 +607,41 @@ int LogRollingFileSink::WriteLine(int dbgLevel, char *hdr, char *string)
 int Logger::iIndentStep = 2;
 bool Logger::bInitialized = false;
 std::queue<void *> Logger::buffers;
+LogRecordQueue *Logger::asyncQueue = NULL;
 ILoggerList Logger::loggers;
 ILoggerSinkList Logger::sinks;
+ILoggerRecordSinkList Logger::recordSinks;
+std::atomic<int> Logger::numSinks(0);
+std::atomic<int> Logger::numRecordSinks(0);
+std::map<int, std::pair<std::string, std::string> > Logger::events;
 Logger::TimeFormat Logger::kTimeFormat = kTFLog4Net;
 LogProperties Logger::properties;
 
+static std::mutex registryLock;
+static std::mutex bufferLock;
+static std::mutex sinkLock;
+static std::mutex asyncLock;
+static std::condition_variable asyncWakeup;
+static std::thread asyncThread;
+static std::atomic<bool> asyncRunning(false);
+static std::atomic<int> asyncProducers(0);	// callers between the asyncRunning check and their Push
+
 void Logger::SendToSinks(int dbgLevel, char *hdr, char *string)
+{
+	// DisableAsync waits for producers that saw asyncRunning, so no record is pushed after the last drain
+	asyncProducers++;
+	if (asyncRunning) {
+		asyncQueue->Push(dbgLevel, hdr, string);
+		asyncProducers--;
+		asyncWakeup.notify_one();
+		return;
+	}
+	asyncProducers--;
+	std::lock_guard<std::mutex> lock(sinkLock);
+	WriteToSinks(dbgLevel, hdr, string);
+}
+
+void Logger::WriteToSinks(int dbgLevel, char *hdr, char *string)
 {
 	ILogOutputSink *pSink = NULL;
 	ILoggerSinkList::iterator it;
@@ -419,43 +696,142 @@ static int gettimeofday(struct timeval *tv, struct timezone *tz)
 	return 0;
 }
 #endif
+
+//
+// Log time in micro seconds. The wall clock is sampled once and then advanced with
+// the monotonic clock, so timestamps never go backwards when the system time is adjusted.
+//
+#ifdef WIN32
+static uint64_t LogTimeMicros()
+{
+	struct timeval tmv;
+	gettimeofday(&tmv, NULL);
+	return (uint64_t)tmv.tv_sec * 1000000 + tmv.tv_usec;
+}
+#else
+static uint64_t MonotonicMicros()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+class LogClockBase
+{
+public:
+	uint64_t tWall;
+	uint64_t tMonotonic;
+	LogClockBase() {
+		struct timeval tmv;
+		gettimeofday(&tmv, NULL);
+		tWall = (uint64_t)tmv.tv_sec * 1000000 + tmv.tv_usec;
+		tMonotonic = MonotonicMicros();
+	}
+};
+
+static uint64_t LogTimeMicros()
+{
+	static LogClockBase base;
+	return base.tWall + (MonotonicMicros() - base.tMonotonic);
+}
+#endif
+
 //
 // Returns a formatted time string for logging
 // string can be either in default kTFLog4Net format or Unix
 //
+// Each thread caches the string for the current second, only the milliseconds
+// are patched in when several lines are logged within the same second.
+//
 char *Logger::TimeString(int maxchar, char *dst)
 {
-	struct timeval tmv;
-	gettimeofday(&tmv, NULL);
-	
-	switch(kTimeFormat)
+	thread_local time_t tCached = -1;
+	thread_local TimeFormat fmtCached = kTFDefault;
+	thread_local char sCached[32];
+	thread_local int lenCached = 0;
+
+	uint64_t tNow = LogTimeMicros();
+	time_t tSec = (time_t)(tNow / 1000000);
+	int msec = (int)((tNow % 1000000) / 1000);
+
+	if ((tSec != tCached) || (kTimeFormat != fmtCached))
 	{
-		case kTFDefault :
-		case kTFUnix :
+		switch(kTimeFormat)
+		{
+			case kTFDefault :
+			case kTFUnix :
 #ifdef WIN32
-			//ctime_s(&tmv.tv_sec, 24,dst);
+				ctime_s(sCached, 32, &tSec);
 #else
-			ctime_r(&tmv.tv_sec, dst);
+				ctime_r(&tSec, sCached);
 #endif
-			dst[24] = '\0';
-			break;
-		case kTFLog4Net :
-			{
-				time_t bla = tmv.tv_sec;
-				struct tm *gmt = gmtime(&bla);
-				snprintf(dst,maxchar,"%.2d.%.2d.%.4d %.2d:%.2d:%.2d.%.3d",
-						 gmt->tm_mday,gmt->tm_mon,gmt->tm_year+1900, 
-						 gmt->tm_hour,gmt->tm_min,gmt->tm_sec,tmv.tv_usec/1000);
-			}
-			break;
-			
+				sCached[24] = '\0';
+				lenCached = 24;
+				break;
+			case kTFLog4Net :
+				{
+					struct tm gmt;
+#ifdef WIN32
+					gmtime_s(&gmt, &tSec);
+#else
+					gmtime_r(&tSec, &gmt);
+#endif
+					// Milliseconds are appended per call
+					lenCached = snprintf(sCached,32,"%.2d.%.2d.%.4d %.2d:%.2d:%.2d.",
+							 gmt.tm_mday,gmt.tm_mon+1,gmt.tm_year+1900,
+							 gmt.tm_hour,gmt.tm_min,gmt.tm_sec);
+				}
+				break;
+		}
+		tCached = tSec;
+		fmtCached = kTimeFormat;
+	}
+
+	int len = (lenCached < maxchar) ? lenCached : maxchar - 1;
+	memcpy(dst, sCached, len);
+	if ((kTimeFormat == kTFLog4Net) && ((len + 3) < maxchar))
+	{
+		dst[len++] = '0' + (msec / 100);
+		dst[len++] = '0' + ((msec / 10) % 10);
+		dst[len++] = '0' + (msec % 10);
 	}
+	dst[len] = '\0';
 	return dst;
 }
 
+//
+// Structured events skip formatting completely, the record is handed to the
+// record sinks as is (synchronously, also in async mode, a record is only a copy)
+//
+void Logger::Event(int iDbgLevel, int eventId, int numArgs, const double *args)
+{
+	if (!properties.IsLevelEnabled(iDbgLevel)) {
+		return;
+	}
+	LogBinaryRecord record;
+	record.timestamp = LogTimeMicros();
+	record.loggerId = (uint16_t)iId;
+	record.level = (uint16_t)iDbgLevel;
+	record.eventId = (uint16_t)eventId;
+	if (numArgs > LOG_BINARY_MAX_ARGS) {
+		numArgs = LOG_BINARY_MAX_ARGS;
+	}
+	record.numArgs = (uint8_t)numArgs;
+	record.reserved = 0;
+	for (int i=0;i<LOG_BINARY_MAX_ARGS;i++) {
+		record.args[i] = (i < numArgs) ? args[i] : 0.0;
+	}
+
+	std::lock_guard<std::mutex> lock(sinkLock);
+	for (ILoggerRecordSinkList::iterator it = recordSinks.begin(); it != recordSinks.end(); it++) {
+		(*it)->WriteRecord(this, &record);
+	}
+}
+
 void *Logger::RequestBuffer()
 {
 	void *res = NULL;
+	std::lock_guard<std::mutex> lock(bufferLock);
 	if (buffers.empty())
 	{
 		res = (void *)new MsgBuffer();
@@ -467,17 +843,136 @@ void *Logger::RequestBuffer()
 }
 void Logger::ReleaseBuffer(void *pBuf)
 {
+	std::lock_guard<std::mutex> lock(bufferLock);
 	buffers.push(pBuf);
 }
 
+//
+// Async logging, the calling thread only formats and queues the message, a background
+// thread owns the sinks. When the queue is full messages are dropped (and counted)
+// rather than blocking the caller.
+//
+bool Logger::EnableAsync(int maxRecords)
+{
+	Initialize();
+	if (asyncRunning) {
+		return true;
+	}
+	if (asyncQueue == NULL) {
+		asyncQueue = new LogRecordQueue(maxRecords);
+	}
+	asyncRunning = true;
+	asyncThread = std::thread(Logger::AsyncSinkThread);
+	return true;
+}
+
+void Logger::DisableAsync()
+{
+	if (!asyncRunning) {
+		return;
+	}
+	asyncRunning = false;
+	while (asyncProducers > 0) {
+		std::this_thread::yield();
+	}
+	asyncWakeup.notify_one();
+	asyncThread.join();
+
+	// Records pushed while the thread did its last drain, nothing can be pushed from here on
+	std::lock_guard<std::mutex> lock(sinkLock);
+	LogRecord *record;
+	while ((record = asyncQueue->Front()) != NULL) {
+		WriteToSinks(record->dbgLevel, record->hdr, record->string);
+		asyncQueue->PopFront();
+	}
+	if (asyncQueue->Dropped() > 0) {
+		char sHdr[64];
+		char sMsg[64];
+		snprintf(sHdr, 64, "Logger - ");
+		snprintf(sMsg, 64, "async queue full, dropped %llu messages", asyncQueue->Dropped());
+		WriteToSinks(kMCWarning, sHdr, sMsg);
+	}
+}
+
+unsigned long long Logger::DroppedMessages()
+{
+	return (asyncQueue != NULL) ? asyncQueue->Dropped() : 0;
+}
+
+void Logger::AsyncSinkThread()
+{
+	bool running = true;
+	while (running) {
+		// Check before draining, anything queued before the stop is still written
+		running = asyncRunning;
+		LogRecord *record;
+		// Sinks can be added from other threads
+		std::unique_lock<std::mutex> sinkGuard(sinkLock);
+		while ((record = asyncQueue->Front()) != NULL) {
+			WriteToSinks(record->dbgLevel, record->hdr, record->string);
+			asyncQueue->PopFront();
+		}
+		sinkGuard.unlock();
+		if (running) {
+			std::unique_lock<std::mutex> lock(asyncLock);
+			asyncWakeup.wait_for(lock, std::chrono::milliseconds(10));
+		}
+	}
+}
+
+//
+// Logger registry, open addressing hash table on the logger name. Slots are only ever
+// filled (loggers are never deleted) so lookups run without locking, creating a
+// logger is serialized. Loggers that don't fit the table are only found in the list.
+//
+#define LOG_REGISTRY_SIZE 256
+static std::atomic<ILogger *> registry[LOG_REGISTRY_SIZE];
+
+static size_t HashLoggerName(const char *name)
+{
+	// FNV-1a
+	size_t hash = 2166136261u;
+	while (*name) {
+		hash = (hash ^ (unsigned char)*name++) * 16777619u;
+	}
+	return hash;
+}
+
+static ILogger *FindRegisteredLogger(const char *name, size_t hash)
+{
+	for (int i=0;i<LOG_REGISTRY_SIZE;i++)
+	{
+		ILogger *pLogger = registry[(hash + i) & (LOG_REGISTRY_SIZE-1)].load(std::memory_order_acquire);
+		if (pLogger == NULL)
+		{
+			return NULL;
+		}
+		if (!strcmp(pLogger->GetName(), name))
+		{
+			return pLogger;
+		}
+	}
+	return NULL;
+}
+
 ILogger *Logger::GetLogger(const char *name)
 {
 	ILogger *pLogger = NULL;
 	LoggerInstance *pInstance;
 	ILoggerList::iterator it;
-	
+	size_t hash = HashLoggerName(name);
+
+	// Fast path, a registered logger implies we are initialized
+	pLogger = FindRegisteredLogger(name, hash);
+	if (pLogger != NULL)
+	{
+		return pLogger;
+	}
+
+	std::lock_guard<std::mutex> lock(registryLock);
 	Initialize();
-	
+
+	// Might have been created while we waited, or not fit the table
 	it = loggers.begin();
 	while(it != loggers.end())
 	{
@@ -491,11 +986,20 @@ ILogger *Logger::GetLogger(const char *name)
 	}
 	
 	// Have to create a new logger
-	pLogger = (ILogger *)new Logger(name);
+	pLogger = (ILogger *)new Logger(name, (int)loggers.size());
 	pInstance = new LoggerInstance(pLogger);
 	// TODO: Support for exclude list
 	
 	loggers.push_back(pInstance);
+	for (int i=0;i<LOG_REGISTRY_SIZE;i++)
+	{
+		std::atomic<ILogger *> &slot = registry[(hash + i) & (LOG_REGISTRY_SIZE-1)];
+		if (slot.load(std::memory_order_relaxed) == NULL)
+		{
+			slot.store(pLogger, std::memory_order_release);
+			break;
+		}
+	}
 	return pLogger;
 	
 }
@@ -504,6 +1008,7 @@ void Logger::SetAllSinkDebugLevel(int iNewDebugLevel)
 	// This might very well be the first call, make sure we are initalized
 	Initialize();
 	
+	std::lock_guard<std::mutex> lock(sinkLock);
 	LogBaseSink *pSink = NULL;
 	ILoggerSinkList::iterator it;
 	it = sinks.begin();
@@ -523,7 +1028,9 @@ void Logger::AddSink(ILogOutputSink *pSink, const char *sName)
 	if (pBase != NULL) {
 		pBase->SetName(sName);
 	}
+	std::lock_guard<std::mutex> lock(sinkLock);
 	sinks.push_back(pSink);
+	numSinks = (int)sinks.size();
 }
 // With initialization
 void Logger::AddSink(ILogOutputSink *pSink, const char *sName, int argc, char **argv)
@@ -532,6 +1039,39 @@ void Logger::AddSink(ILogOutputSink *pSink, const char *sName, int argc, char **
 	AddSink(pSink, sName);
 }
 
+void Logger::AddRecordSink(ILogRecordSink *pSink)
+{
+	std::lock_guard<std::mutex> lock(sinkLock);
+	recordSinks.push_back(pSink);
+	numRecordSinks = (int)recordSinks.size();
+}
+
+// Once this returns no event is written to 'pSink', the caller may close and delete it
+void Logger::RemoveRecordSink(ILogRecordSink *pSink)
+{
+	std::lock_guard<std::mutex> lock(sinkLock);
+	recordSinks.remove(pSink);
+	numRecordSinks = (int)recordSinks.size();
+}
+
+void Logger::RegisterEvent(int eventId, const char *name, const char *argNames)
+{
+	std::lock_guard<std::mutex> lock(registryLock);
+	events[eventId] = std::pair<std::string, std::string>(name, argNames);
+}
+
+bool Logger::GetEventInfo(int eventId, std::string &name, std::string &argNames)
+{
+	std::lock_guard<std::mutex> lock(registryLock);
+	std::map<int, std::pair<std::string, std::string> >::iterator it = events.find(eventId);
+	if (it == events.end()) {
+		return false;
+	}
+	name = it->second.first;
+	argNames = it->second.second;
+	return true;
+}
+
 //
 // Create sink's based on class name and factory instances in the global list
 //
@@ -556,7 +1096,7 @@ void Logger::RebuildSinksFromConfiguration()
 	std::vector<std::string> arAppenders;
 
 	// TODO: need to call destructors here I guess
-	sinks.clear();
+	ILoggerSinkList newSinks;
 
 	int nAppenders = StrExplode(&arAppenders, appenders, ',');
 	for (int i=0;i<nAppenders;i++)
@@ -576,10 +1116,13 @@ void Logger::RebuildSinksFromConfiguration()
 				}
 				// 2) Call initialize and attach
 				pSink->Initialize(0,NULL);
-				sinks.push_back(pSink);
+				newSinks.push_back(pSink);
 			}
 		}
 	}
+	std::lock_guard<std::mutex> lock(sinkLock);
+	sinks.swap(newSinks);
+	numSinks = (int)sinks.size();
 }
 
 void Logger::Initialize()
@@ -607,9 +1150,10 @@ void Logger::Initialize()
 
 // Regular functions
 
-Logger::Logger(const char *sName)
+Logger::Logger(const char *sName, int iId)
 {
 	this->sName = strdup(sName);
+	this->iId = iId;
 	this->iIndentLevel = 0;
 	this->sIndent = (char *)malloc(MAX_INDENT+1);
 	memset(this->sIndent,0,MAX_INDENT+1);
@@ -840,6 +1384,83 @@ void MsgBuffer::Extend()
 	}
 	buffer = tmp;
 }
+// ---------------------------------------------------------------------------
+//
+// Async record queue, capacity is rounded up to a power of two
+//
+LogRecordQueue::LogRecordQueue(size_t capacity)
+{
+	size_t sz = 2;
+	while (sz < capacity) {
+		sz <<= 1;
+	}
+	cells = new Cell[sz];
+	mask = sz - 1;
+	for (size_t i=0;i<sz;i++) {
+		cells[i].sequence.store(i, std::memory_order_relaxed);
+	}
+	enqueuePos.store(0, std::memory_order_relaxed);
+	dequeuePos = 0;
+	dropped = 0;
+}
+LogRecordQueue::~LogRecordQueue()
+{
+	delete[] cells;
+}
+
+static void CopyTruncated(char *dst, const char *src, size_t maxlen)
+{
+	size_t len = strlen(src);
+	if (len >= maxlen) {
+		len = maxlen - 1;
+	}
+	memcpy(dst, src, len);
+	dst[len] = '\0';
+}
+
+bool LogRecordQueue::Push(int dbgLevel, const char *hdr, const char *string)
+{
+	Cell *cell;
+	size_t pos = enqueuePos.load(std::memory_order_relaxed);
+	for (;;) {
+		cell = &cells[pos & mask];
+		size_t seq = cell->sequence.load(std::memory_order_acquire);
+		intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+		if (dif == 0) {
+			if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+				break;
+			}
+		} else if (dif < 0) {
+			// Full, the consumer has not released this cell yet
+			dropped++;
+			return false;
+		} else {
+			pos = enqueuePos.load(std::memory_order_relaxed);
+		}
+	}
+	cell->record.dbgLevel = dbgLevel;
+	CopyTruncated(cell->record.hdr, hdr, LOG_RECORD_MAX_HDR);
+	CopyTruncated(cell->record.string, string, LOG_RECORD_MAX_STRING);
+	cell->sequence.store(pos + 1, std::memory_order_release);
+	return true;
+}
+
+LogRecord *LogRecordQueue::Front()
+{
+	Cell *cell = &cells[dequeuePos & mask];
+	if (cell->sequence.load(std::memory_order_acquire) != (dequeuePos + 1)) {
+		return NULL;
+	}
+	return &cell->record;
+}
+
+void LogRecordQueue::PopFront()
+{
+	Cell *cell = &cells[dequeuePos & mask];
+	cell->sequence.store(dequeuePos + mask + 1, std::memory_order_release);
+	dequeuePos++;
+}
+
 // ---------------------------------------------------------------------------
 //
 // Property handling
@@ -38,16 +38,20 @@ Changes:
 ---------------------------------------------------------------------------*/
 #include <stdlib.h>
 #include <stdio.h>
+#include <time.h>
 
 #include <list>
 #include <queue>
 #include <map>
 #include <vector>
 #include <string>
+#include <atomic>
 
 #ifndef __LOGGER_H__
 #define __LOGGER_H__
 
+#include "logrecord.h"
+
 
 using namespace std;
 
@@ -68,6 +72,7 @@ namespace gnilk
 		virtual int GetIndent() = 0;
 		virtual int SetIndent(int nIndent) = 0;
 		virtual char *GetName() = 0;
+		virtual int GetId() = 0;
 		
 		// functions
 		virtual void WriteLine(const char *sFormat,...) = 0;
@@ -77,6 +82,8 @@ namespace gnilk
 		virtual void Warning(const char *sFormat, ...) = 0;
 		virtual void Info(const char *sFormat, ...) = 0;
 		virtual void Debug(const char *sFormat, ...) = 0;
+		// Structured event, numeric arguments only, goes to the record sinks
+		virtual void Event(int iDbgLevel, int eventId, int numArgs, const double *args) = 0;
 		
 		virtual void Enter() = 0;
 		virtual void Leave() = 0;
@@ -163,6 +170,14 @@ namespace gnilk
 		virtual int WriteLine(int dbgLevel, char *hdr, char *string) = 0;
 		virtual void Close() = 0;
 	};
+	// Sinks receiving structured events (see logrecord.h) instead of text
+	class ILogRecordSink
+	{
+	public:
+		virtual void WriteRecord(ILogger *pLogger, const LogBinaryRecord *record) = 0;
+		virtual void Close() = 0;
+	};
+
 	class LogBaseSink : public ILogOutputSink
 	{
 	protected:
@@ -225,6 +240,61 @@ namespace gnilk
 		static ILogOutputSink * LOG_CALLCONV CreateInstance(const char *className);
 	};
 	
+	//
+	// Rolling file sink appending into a large memory buffer. The file size is tracked
+	// in memory, the buffer is written out when full, when pending data is older than
+	// the flush interval (checked on write) and on Close or exit.
+	//
+	class LogBufferedFileSink : public LogFileSink
+	{
+	private:
+		char *buffer;
+		long szBuffer;
+		long nBuffered;
+		long nBytes;			// written + buffered, current file
+		long nBytesRollLimit;
+		int nMaxBackupIndex;
+		time_t tFirstPending;
+		int flushInterval;		// seconds
+
+		char *GetFileName(char *dst, int idx);
+		void Append(const char *data, long len);
+		void Flush();
+		void RollOver();
+		static void FlushAtExit();
+	public:
+		LogBufferedFileSink();
+		virtual ~LogBufferedFileSink();
+		virtual void Initialize(int argc, char **argv);
+		virtual int WriteLine(int dbgLevel, char *hdr, char *string);
+		virtual void Close();
+
+		static ILogOutputSink * LOG_CALLCONV CreateInstance(const char *className);
+	};
+
+	//
+	// Binary record sink, fixed size records, no text formatting at all.
+	// Use 'logdecode' to turn the file into text or CSV.
+	//
+	class LogBinaryFileSink : public ILogRecordSink
+	{
+	private:
+		FILE *fOut;
+		char *buffer;
+		std::vector<bool> loggersWritten;
+		std::vector<bool> eventsWritten;
+
+		void WriteLoggerName(ILogger *pLogger);
+		void WriteEventInfo(int eventId);
+		void WriteString(const char *str);
+	public:
+		LogBinaryFileSink();
+		virtual ~LogBinaryFileSink();
+		bool Open(const char *filename);
+		virtual void WriteRecord(ILogger *pLogger, const LogBinaryRecord *record);
+		virtual void Close();
+	};
+
 	class LoggerInstance
 	{
 	public:
@@ -238,8 +308,12 @@ namespace gnilk
 
 
 
+	class LogRecordQueue;
+
 	typedef std::list<LoggerInstance *> ILoggerList;
+
 	typedef std::list<ILogOutputSink *>ILoggerSinkList;
+	typedef std::list<ILogRecordSink *>ILoggerRecordSinkList;
 
 	class Logger : public ILogger
 	{
@@ -265,7 +339,8 @@ namespace gnilk
 		char *sName;
 		char *sIndent;
 		int iIndentLevel;
-		Logger(const char *sName);
+		int iId;
+		Logger(const char *sName, int iId);
 		void WriteReportString(int mc, char *string);
 		void GenerateIndentString();
 		
@@ -275,10 +350,19 @@ namespace gnilk
 		static int iIndentStep;
 		static ILoggerList loggers;
 		static ILoggerSinkList sinks;
+		static ILoggerRecordSinkList recordSinks;
+		// Sizes of the lists above, the lists are only touched under the sink lock but the
+		// level checks read these from any thread
+		static std::atomic<int> numSinks;
+		static std::atomic<int> numRecordSinks;
+		static std::map<int, std::pair<std::string, std::string> > events;
 		static LogProperties properties;
 		static std::queue<void *> buffers;
+		static LogRecordQueue *asyncQueue;
 		static char *TimeString(int maxchar, char *dst);
 		static void SendToSinks(int dbgLevel, char *hdr, char *string);
+		static void WriteToSinks(int dbgLevel, char *hdr, char *string);
+		static void AsyncSinkThread();
 		static void RebuildSinksFromConfiguration();
 	public:
 	
@@ -289,6 +373,18 @@ namespace gnilk
 		static void SetAllSinkDebugLevel(int iNewDebugLevel);
 		static void AddSink(ILogOutputSink *pSink, const char *sName);
 		static void AddSink(ILogOutputSink *pSink, const char *sName, int argc, char **argv);
+		static void AddRecordSink(ILogRecordSink *pSink);
+		static void RemoveRecordSink(ILogRecordSink *pSink);
+
+		// Names an event id for the decoder, argNames is a comma separated list
+		static void RegisterEvent(int eventId, const char *name, const char *argNames);
+		static bool GetEventInfo(int eventId, std::string &name, std::string &argNames);
+
+		// Async mode, messages are queued and written by a background thread.
+		// DisableAsync writes everything queued before it returns.
+		static bool EnableAsync(int maxRecords);
+		static void DisableAsync();
+		static unsigned long long DroppedMessages();
 
 		// Refactor this to a LogManager
 		static void *RequestBuffer();
@@ -299,6 +395,9 @@ namespace gnilk
 
 
 		static LogProperties *GetProperties() { return &Logger::properties; }
+		// Early rejection for the LOG_xxx macros, false if a message of this class can't reach a sink
+		__inline static bool IsLevelEnabled(int mc) { return (Logger::properties.IsLevelEnabled(mc) && (Logger::numSinks.load(std::memory_order_relaxed) > 0)); }
+		__inline static bool IsEventLevelEnabled(int mc) { return (Logger::properties.IsLevelEnabled(mc) && (Logger::numRecordSinks.load(std::memory_order_relaxed) > 0)); }
 
 		__inline bool IsDebugEnabled() { return (Logger::properties.IsLevelEnabled((int)kMCDebug)?true:false);}
 		__inline bool IsInfoEnabled() { return (Logger::properties.IsLevelEnabled((int)kMCInfo)?true:false);}
@@ -310,6 +409,7 @@ namespace gnilk
 		virtual int GetIndent() { return iIndentLevel; };
 		virtual int SetIndent(int nIndent) { iIndentLevel = nIndent; return iIndentLevel; };
 		virtual char *GetName() { return sName;};
+		virtual int GetId() { return iId; }
 		
 		// Functions
 		virtual void WriteLine(int iDbgLevel, const char *sFormat,...);
@@ -319,11 +419,47 @@ namespace gnilk
 		virtual void Warning(const char *sFormat, ...);
 		virtual void Info(const char *sFormat, ...);
 		virtual void Debug(const char *sFormat, ...);
+		virtual void Event(int iDbgLevel, int eventId, int numArgs, const double *args);
 
 		// Enter leave functions, use to auto-indent flow statements, take care on exceptions!
 		virtual void Enter();
 		virtual void Leave();
 	};
+
+	// Resolves the logger once per call site, loggers are never deleted so the handle stays valid.
+	// Use in hot paths instead of Logger::GetLogger, name must be a constant.
+#define CACHED_LOGGER(__name) ([]() -> gnilk::ILogger * { static gnilk::ILogger *pCached = gnilk::Logger::GetLogger(__name); return pCached; }())
+
+	// Calls below LOG_COMPILE_LEVEL are compiled out, i.e. -DLOG_COMPILE_LEVEL=200 strips debug
+	// output from release builds. Otherwise the level is checked before the arguments are evaluated.
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL 0
+#endif
+#define LOG_AT_LEVEL(__level, __func, __logger, ...) \
+	do { \
+		if (((__level) >= LOG_COMPILE_LEVEL) && gnilk::Logger::IsLevelEnabled(__level)) { \
+			(__logger)->__func(__VA_ARGS__); \
+		} \
+	} while(0)
+#define LOG_DEBUG(__logger, ...) LOG_AT_LEVEL(gnilk::Logger::kMCDebug, Debug, __logger, __VA_ARGS__)
+#define LOG_INFO(__logger, ...) LOG_AT_LEVEL(gnilk::Logger::kMCInfo, Info, __logger, __VA_ARGS__)
+#define LOG_WARNING(__logger, ...) LOG_AT_LEVEL(gnilk::Logger::kMCWarning, Warning, __logger, __VA_ARGS__)
+#define LOG_ERROR(__logger, ...) LOG_AT_LEVEL(gnilk::Logger::kMCError, Error, __logger, __VA_ARGS__)
+
+	// Each argument is converted on its own, a braced list of mixed int/size_t/float would narrow
+	template<typename... Args>
+	inline void WriteLogEvent(ILogger *pLogger, int level, int eventId, Args... args) {
+		const double values[] = { static_cast<double>(args)... };
+		pLogger->Event(level, eventId, (int)sizeof...(Args), values);
+	}
+
+	// Structured event to the record sinks, arguments are numeric and converted to double
+#define LOG_EVENT(__logger, __level, __event, ...) \
+	do { \
+		if (((__level) >= LOG_COMPILE_LEVEL) && gnilk::Logger::IsEventLevelEnabled(__level)) { \
+			gnilk::WriteLogEvent((__logger), (__level), (__event), __VA_ARGS__); \
+		} \
+	} while(0)
 	
 }
 
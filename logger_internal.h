@@ -27,6 +27,7 @@ Changes:
 #include <queue>
 #include <map>
 #include <string>
+#include <atomic>
 
 #ifndef __LOGGER_INTERNAL_H__
 #define __LOGGER_INTERNAL_H__
@@ -90,6 +91,49 @@ namespace gnilk
 
 	typedef std::pair<std::string, std::string> strStrPair;
 
+	#define LOG_RECORD_MAX_HDR (MAX_INDENT + 64)
+	#define LOG_RECORD_MAX_STRING 1024
+
+	// Preformatted message, strings longer than the record are truncated
+	class LogRecord
+	{
+	public:
+		int dbgLevel;
+		char hdr[LOG_RECORD_MAX_HDR];
+		char string[LOG_RECORD_MAX_STRING];
+	};
+
+	//
+	// Bounded multi producer, single consumer queue of log records. Producers claim a
+	// cell with a CAS on the write position, each cell has a sequence number telling
+	// whether it is free or holds a record. A full queue drops the record and counts it,
+	// memory use is fixed at capacity * sizeof(LogRecord).
+	//
+	class LogRecordQueue
+	{
+	private:
+		class Cell
+		{
+		public:
+			std::atomic<size_t> sequence;
+			LogRecord record;
+		};
+		Cell *cells;
+		size_t mask;
+		std::atomic<size_t> enqueuePos;
+		size_t dequeuePos;		// consumer only
+		std::atomic<unsigned long long> dropped;
+	public:
+		LogRecordQueue(size_t capacity);
+		virtual ~LogRecordQueue();
+
+		bool Push(int dbgLevel, const char *hdr, const char *string);
+		// Consumer side, Front returns NULL when empty
+		LogRecord *Front();
+		void PopFront();
+		unsigned long long Dropped() { return dropped; }
+	};
+
 }
 
 #endif
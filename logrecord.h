@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdint.h>
+
+//
+// Binary log format, written by LogBinaryFileSink and read by logdecode.
+// The file starts with a header followed by tagged entries, each entry starts with
+// one byte of LogEntryType. Logger and event names are written once, before the
+// first record referring to them.
+//
+namespace gnilk
+{
+#define LOG_BINARY_MAGIC 0x474f4c42		// 'BLOG'
+#define LOG_BINARY_VERSION 1
+#define LOG_BINARY_MAX_ARGS 6
+
+	typedef enum
+	{
+		kLogEntry_Logger = 1,	// uint16 id, uint16 len, name
+		kLogEntry_Event = 2,	// uint16 id, uint16 len, name, uint16 len, comma separated argument names
+		kLogEntry_Record = 3,	// LogBinaryRecord
+	} LogEntryType;
+
+#pragma pack(push, 1)
+	typedef struct
+	{
+		uint32_t magic;
+		uint32_t version;
+	} LogBinaryHeader;
+
+	typedef struct
+	{
+		uint64_t timestamp;		// micro seconds since epoch
+		uint16_t loggerId;
+		uint16_t level;
+		uint16_t eventId;
+		uint8_t numArgs;
+		uint8_t reserved;
+		double args[LOG_BINARY_MAX_ARGS];
+	} LogBinaryRecord;
+#pragma pack(pop)
+}
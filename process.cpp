@@ -4,10 +4,15 @@ TODO:
 - Argument handling
 - Callback interface
 - Nonblocking does not work second pipe??????
+
+The monitoring loop is event driven, it blocks in poll() on both pipes and
+drains them until the child has closed them (EOF), then reaps the child with
+a blocking waitpid. Nothing spins while the child runs.
 */
 
 #include <stdio.h>
 #include <iostream>
+#include <algorithm>
 
 #include <spawn.h>
 #include <unistd.h>
@@ -16,8 +21,11 @@ TODO:
 #include <sys/stat.h>
 #include <sys/wait.h>
 #include <poll.h>
+#include <signal.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <string.h>
+#include <errno.h>
 
 
 #include "process.h"
@@ -25,13 +33,18 @@ TODO:
 
 using namespace gnilk;
 
-Process::Process(std::string command) {
+Process::Process(std::string command) :
+	finished(false)
+{
 	this->command = command;
 	this->callback = NULL;
+	this->result = false;
 }
 
 Process::~Process() {
-
+	if (worker.joinable()) {
+		worker.join();
+	}
 }
 
 void Process::SetCallback(ProcessCallbackInterface *_callback) {
@@ -54,7 +67,7 @@ void Process::AddArgument(const char *format, ...) {
 	if (res >= 0) {
 		arguments.push_back(newstr);
 	} else {
-		Logger::GetLogger("Process")->Error("Buffer overflow in AddArgument detected");
+		CACHED_LOGGER("Process")->Error("Buffer overflow in AddArgument detected");
 	}
 }
 
@@ -66,6 +79,26 @@ bool Process::ExecuteAndWait() {
 	return process.SpawnAndLoop(command, arguments, dynamic_cast<ProcessCallbackBase *>(this));
 }
 
+bool Process::ExecuteAsync() {
+	if (worker.joinable()) {
+		CACHED_LOGGER("Process")->Error("ExecuteAsync, process already running");
+		return false;
+	}
+	finished = false;
+	worker = std::thread([this]() {
+		result = ExecuteAndWait();
+		finished = true;
+	});
+	return true;
+}
+
+bool Process::Wait() {
+	if (worker.joinable()) {
+		worker.join();
+	}
+	return result;
+}
+
 void Process::OnProcessStarted() {
 	if (callback != NULL) {
 		callback->OnProcessStarted();
@@ -77,14 +110,75 @@ void Process::OnProcessExit() {
 	}
 
 }
-void Process::OnStdOutData(std::string data) {
+void Process::OnStdOutData(const char *data, size_t len) {
 	if (callback != NULL) {
-		callback->OnStdOutData(data);
+		callback->OnStdOutData(data, len);
 	}
 }
-void Process::OnStdErrData(std::string data) {
+void Process::OnStdErrData(const char *data, size_t len) {
 	if (callback != NULL) {
-		callback->OnStdErrData(data);
+		callback->OnStdErrData(data, len);
+	}
+}
+
+//////// -- Line splitter
+
+ProcessLineSplitter::ProcessLineSplitter(ProcessLineCallbackInterface *callback) {
+	this->callback = callback;
+}
+
+void ProcessLineSplitter::OnProcessStarted() {
+	carryOut.clear();
+	carryErr.clear();
+	callback->OnProcessStarted();
+}
+
+void ProcessLineSplitter::OnProcessExit() {
+	// Last line might not be terminated
+	Flush(carryOut, true);
+	Flush(carryErr, false);
+	callback->OnProcessExit();
+}
+
+void ProcessLineSplitter::OnStdOutData(const char *data, size_t len) {
+	Split(carryOut, true, data, len);
+}
+
+void ProcessLineSplitter::OnStdErrData(const char *data, size_t len) {
+	Split(carryErr, false, data, len);
+}
+
+void ProcessLineSplitter::Split(std::vector<char> &carry, bool isStdOut, const char *data, size_t len) {
+	const char *end = data + len;
+	while (data < end) {
+		const char *eol = (const char *)memchr(data, '\n', end - data);
+		if (eol == NULL) {
+			carry.insert(carry.end(), data, end);
+			return;
+		}
+		if (carry.empty()) {
+			Emit(isStdOut, data, eol - data);
+		} else {
+			carry.insert(carry.end(), data, eol);
+			Emit(isStdOut, &carry[0], carry.size());
+			carry.clear();
+		}
+		data = eol + 1;
+	}
+}
+
+void ProcessLineSplitter::Flush(std::vector<char> &carry, bool isStdOut) {
+	if (!carry.empty()) {
+		Emit(isStdOut, &carry[0], carry.size());
+		carry.clear();
+	}
+}
+
+void ProcessLineSplitter::Emit(bool isStdOut, const char *line, size_t len) {
+	if (isStdOut) {
+		callback->OnStdOutLine(line, len);
+	} else {
+		callback->OnStdErrLine(line, len);
 	}
 }
 
@@ -93,7 +187,12 @@ void Process::OnStdErrData(std::string data) {
 extern char **environ;
 
 Process_Unix::Process_Unix() {
-
+	withStdIn = false;
+	pipe_stdin[0] = pipe_stdin[1] = -1;
+	pipe_stdout[0] = pipe_stdout[1] = -1;
+	pipe_stderr[0] = pipe_stderr[1] = -1;
+	pid = -1;
+	exitStatus = -1;
 }
 Process_Unix::~Process_Unix() {
 
@@ -102,13 +201,14 @@ Process_Unix::~Process_Unix() {
 bool Process_Unix::PrepareFileDescriptors() {
 	int status = posix_spawn_file_actions_init(&child_fd_actions);
 	if (status != 0) {
-		Logger::GetLogger("Process_Unix")->Error("posix_spawn_file_actions_init %d, %s", status, strerror(status));
+		CACHED_LOGGER("Process_Unix")->Error("posix_spawn_file_actions_init %d, %s", status, strerror(status));
 		return false;
 	}
 	return true;
 }	
 
 bool Process_Unix::CreatePipes() {
+	if (withStdIn && !CreatePipe(pipe_stdin)) return false;
 	if (!CreatePipe(pipe_stdout)) return false;
 	if (!CreatePipe(pipe_stderr)) return false;
 	return true;
@@ -123,22 +223,40 @@ bool Process_Unix::SetNonBlocking() {
 
 bool Process_Unix::Duplicate() {
 	int status;
+	// stdin
+	if (withStdIn) {
+		status = posix_spawn_file_actions_adddup2(&child_fd_actions, pipe_stdin[0], 0);
+		if (status) {
+			CACHED_LOGGER("Process_Unix")->Error("posix_spawn_file_actions_adddup2 %d, %s", status, strerror(status));
+			return false;
+		}
+		posix_spawn_file_actions_addclose(&child_fd_actions, pipe_stdin[0]);
+		posix_spawn_file_actions_addclose(&child_fd_actions, pipe_stdin[1]);
+	}
 	// stdout
 	status = posix_spawn_file_actions_adddup2(&child_fd_actions, pipe_stdout[1], 1);
 	if (status) {
-		Logger::GetLogger("Process_Unix")->Error("posix_spawn_file_actions_adddup2 %d, %s", status, strerror(status));
+		CACHED_LOGGER("Process_Unix")->Error("posix_spawn_file_actions_adddup2 %d, %s", status, strerror(status));
 		return false;
 	}
 	// stderr
 	status = posix_spawn_file_actions_adddup2(&child_fd_actions, pipe_stderr[1], 2);
 	if (status) {
-		Logger::GetLogger("Process_Unix")->Error("posix_spawn_file_actions_adddup2 %d, %s", status, strerror(status));
+		CACHED_LOGGER("Process_Unix")->Error("posix_spawn_file_actions_adddup2 %d, %s", status, strerror(status));
 		return false;					
 	}
+	// The child only needs the duplicated descriptors
+	posix_spawn_file_actions_addclose(&child_fd_actions, pipe_stdout[0]);
+	posix_spawn_file_actions_addclose(&child_fd_actions, pipe_stdout[1]);
+	posix_spawn_file_actions_addclose(&child_fd_actions, pipe_stderr[0]);
+	posix_spawn_file_actions_addclose(&child_fd_actions, pipe_stderr[1]);
 	return true;
 }
 
-bool Process_Unix::SpawnAndLoop(std::string command, std::list<std::string> &arguments, ProcessCallbackBase *callback) {
+//
+// Spawns the child and closes the pipe ends only the child uses, does not wait
+//
+bool Process_Unix::Spawn(std::string command, std::list<std::string> &arguments) {
 
 	// construct param array
 	int count = arguments.size();
@@ -154,90 +272,176 @@ bool Process_Unix::SpawnAndLoop(std::string command, std::list<std::string> &arg
 	param[i] = NULL;
 
 	int status = posix_spawnp(&pid, command.c_str(), &child_fd_actions, NULL, param, environ);
-	if (status == 0) {
-		Logger::GetLogger("Process_Unix")->Debug("Spawn ok, entering monitoring loop");
-		callback->OnProcessStarted();
-		while (!IsFinished()) {
-			ConsumePipes(callback);
-		 }			
+	posix_spawn_file_actions_destroy(&child_fd_actions);
 
-		Logger::GetLogger("Process_Unix")->Debug("Process loop finished");				
-		callback->OnProcessExit();
+	// Parent only reads, close the write ends so EOF shows up once the child is gone
+	close(pipe_stdout[1]);
+	close(pipe_stderr[1]);
+	pipe_stdout[1] = pipe_stderr[1] = -1;
+	if (withStdIn) {
+		close(pipe_stdin[0]);
+		pipe_stdin[0] = -1;
+	}
 
+	if (status != 0) {
+		CACHED_LOGGER("Process_Unix")->Error("spawn: %d, %s", status, strerror(status));
+		ClosePipe(pipe_stdin);
 		ClosePipe(pipe_stdout);
 		ClosePipe(pipe_stderr);
-	} else {
-		Logger::GetLogger("Process_Unix")->Error("spawn: %d, %s", status, strerror(status));
 		return false;
 	}
-	posix_spawn_file_actions_destroy(&child_fd_actions);
 	return true;
 }
 
-bool Process_Unix::IsFinished() {
+bool Process_Unix::SpawnAndLoop(std::string command, std::list<std::string> &arguments, ProcessCallbackBase *callback) {
+	if (!Spawn(command, arguments)) {
+		return false;
+	}
+
+	CACHED_LOGGER("Process_Unix")->Debug("Spawn ok, entering monitoring loop");
+	callback->OnProcessStarted();
+	while (ConsumePipes(callback)) {
+		// Blocks until there is data, leaves when both pipes are drained and closed
+	}
+	WaitForExit();
+
+	CACHED_LOGGER("Process_Unix")->Debug("Process loop finished");				
+	callback->OnProcessExit();
+
+	ClosePipe(pipe_stdin);
+	ClosePipe(pipe_stdout);
+	ClosePipe(pipe_stderr);
+	return true;
+}
+
+bool Process_Unix::WaitForExit(int timeoutMs /*= -1*/) {
 	int status;
-	pid_t result = waitpid(pid, &status, WNOHANG);
-	if (result == 0) {
-	  // Child still alive
-	} else if (result == -1) {
-	  // Error 
-		Logger::GetLogger("Process_Unix")->Error("Process error");				
-	} else {
-	  // Child exited
-		Logger::GetLogger("Process_Unix")->Debug("Process exit");				
+	pid_t result;
+	int msWaited = 0;
+	while(true) {
+		result = waitpid(pid, &status, (timeoutMs < 0) ? 0 : WNOHANG);
+		if ((result == -1) && (errno == EINTR)) {
+			continue;
+		}
+		if (result != 0) {
+			break;
+		}
+		// Still running
+		if (msWaited >= timeoutMs) {
+			return false;
+		}
+		usleep(10 * 1000);
+		msWaited += 10;
+	}
+
+	if (result == -1) {
+		CACHED_LOGGER("Process_Unix")->Error("waitpid: %d, %s", errno, strerror(errno));
 		return true;
-	}		
-	return false;
+	}
+	exitStatus = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+	CACHED_LOGGER("Process_Unix")->Debug("Process exit, status: %d", exitStatus);
+	return true;
 }
 
-void Process_Unix::ConsumePipes(ProcessCallbackBase *callback) {
-
-	std::string buffer(1024,' ');
-	std::vector<pollfd> plist = { {pipe_stdout[0],POLLIN}, {pipe_stderr[0],POLLIN} };
-	int rval=poll(&plist[0],plist.size(),/*timeout*/0);
-    if ( plist[0].revents&POLLIN) {
-      int bytes_read = read(pipe_stdout[0], &buffer[0], buffer.length());
-      // cout << "read " << bytes_read << " bytes from stdout.\n";
-      // cout << buffer.substr(0, static_cast<size_t>(bytes_read)) << "\n";
-      buffer[bytes_read] = '\0';
-      callback->OnStdOutData(buffer);
-    }
-    else if ( plist[1].revents&POLLIN ) {
-      int bytes_read = read(pipe_stderr[0], &buffer[0], buffer.length());
-      // cout << "read " << bytes_read << " bytes from stderr.\n";
-      // cout << buffer.substr(0, static_cast<size_t>(bytes_read)) << "\n";
+//
+// Waits for data on stdout/stderr and reads whatever is available on both.
+// Returns false when both pipes have been closed by the child.
+//
+bool Process_Unix::ConsumePipes(ProcessCallbackBase *callback) {
+	pollfd plist[2];
+	int nfds = 0;
+	if (pipe_stdout[0] != -1) {
+		plist[nfds].fd = pipe_stdout[0];
+		plist[nfds].events = POLLIN;
+		plist[nfds].revents = 0;
+		nfds++;
+	}
+	if (pipe_stderr[0] != -1) {
+		plist[nfds].fd = pipe_stderr[0];
+		plist[nfds].events = POLLIN;
+		plist[nfds].revents = 0;
+		nfds++;
+	}
+	if (nfds == 0) {
+		return false;
+	}
 
-      buffer[bytes_read] = '\0';
-      callback->OnStdErrData(buffer);
-    }
+	int rval = poll(plist, nfds, /*timeout*/-1);
+	if (rval < 0) {
+		if (errno == EINTR) {
+			return true;
+		}
+		CACHED_LOGGER("Process_Unix")->Error("poll: %d, %s", errno, strerror(errno));
+		return false;
+	}
 
+	for (int i=0;i<nfds;i++) {
+		if (!(plist[i].revents & (POLLIN | POLLHUP | POLLERR))) {
+			continue;
+		}
+		if (plist[i].fd == pipe_stdout[0]) {
+			ReadPipe(pipe_stdout, true, callback);
+		} else {
+			ReadPipe(pipe_stderr, false, callback);
+		}
+	}
+	return true;
+}
 
+// Reads one chunk from the pipe, closes the read end on EOF/error
+bool Process_Unix::ReadPipe(int *filedes, bool isStdOut, ProcessCallbackBase *callback) {
+	if (readBuffer.empty()) {
+		readBuffer.resize(65536);
+	}
+	ssize_t bytes_read = read(filedes[0], &readBuffer[0], readBuffer.size());
+	if (bytes_read > 0) {
+		if (isStdOut) {
+			callback->OnStdOutData(&readBuffer[0], bytes_read);
+		} else {
+			callback->OnStdErrData(&readBuffer[0], bytes_read);
+		}
+		return true;
+	}
+	if ((bytes_read < 0) && ((errno == EINTR) || (errno == EAGAIN))) {
+		return true;
+	}
+	close(filedes[0]);
+	filedes[0] = -1;
+	return false;
 }
 
 // -- pipe helpers
 bool Process_Unix::CreatePipe(int *filedes) {
 	int status = pipe(filedes);
 	if (status == -1) {
-		Logger::GetLogger("Process_Unix")->Error("stdout pipe %d, %s", status, strerror(status));
+		CACHED_LOGGER("Process_Unix")->Error("stdout pipe %d, %s", status, strerror(status));
 		return false;
 	}
+	// Keep our ends out of other children (pool workers), dup2 in the child clears this
+	fcntl(filedes[0], F_SETFD, FD_CLOEXEC);
+	fcntl(filedes[1], F_SETFD, FD_CLOEXEC);
 	return true;
 }
 
 void Process_Unix::ClosePipe(int *filedes) {
-	close(filedes[0]);
-	close(filedes[1]);
+	if (filedes[0] != -1) {
+		close(filedes[0]);
+	}
+	if (filedes[1] != -1) {
+		close(filedes[1]);
+	}
+	filedes[0] = filedes[1] = -1;
 }
 
 bool Process_Unix::SetNonBlockingPipe(int *filedes) {
 	int status = fcntl(filedes[0], O_NONBLOCK);
 	if (status == -1) {
-		Logger::GetLogger("Process_Unix")->Error("fcntl %d", errno);
+		CACHED_LOGGER("Process_Unix")->Error("fcntl %d", errno);
 		return false;
 	}
 	status = fcntl(filedes[1], O_NONBLOCK);
 	if (status == -1) {
-		Logger::GetLogger("conapp")->Error("fcntl %d", errno);
+		CACHED_LOGGER("conapp")->Error("fcntl %d", errno);
 		return false;			
 	}
 	return true;
@@ -245,3 +449,363 @@ bool Process_Unix::SetNonBlockingPipe(int *filedes) {
 
 
 
+
+//////// -- Process pool
+
+ProcessPool::Worker::Worker(ProcessPool *pool, int index) : stderrLines(this) {
+	this->pool = pool;
+	this->index = index;
+	process = NULL;
+	idxJob = -1;
+	replySize = -1;
+	jobsDone = 0;
+	jobsFailed = 0;
+	respawns = 0;
+	tBusy = 0.0;
+	tJobStart = 0.0;
+}
+
+ProcessPool::ProcessPool(std::string command, int numWorkers) {
+	this->command = command;
+	this->callback = NULL;
+	nextJob = 0;
+	jobsLeft = 0;
+	jobTimeout = 0.0;
+	tStart = tEnd = 0.0;
+	if (numWorkers < 1) {
+		numWorkers = 1;
+	}
+	for (int i=0;i<numWorkers;i++) {
+		workers.push_back(new Worker(this, i));
+	}
+}
+
+ProcessPool::~ProcessPool() {
+	for (int i=0;i<workers.size();i++) {
+		StopWorker(workers[i]);
+		delete workers[i];
+	}
+}
+
+void ProcessPool::SetCallback(ProcessPoolCallbackInterface *_callback) {
+	this->callback = _callback;
+}
+
+void ProcessPool::AddArgument(std::string arg) {
+	arguments.push_back(arg);
+}
+
+void ProcessPool::SetJobTimeout(double seconds) {
+	this->jobTimeout = seconds;
+}
+
+int ProcessPool::AddJob(std::string job) {
+	jobs.push_back(job);
+	return jobs.size() - 1;
+}
+
+//
+// Runs all jobs, blocks until every job has either completed or failed
+//
+bool ProcessPool::Run() {
+	// Dead workers are detected through EOF on their stdout instead
+	signal(SIGPIPE, SIG_IGN);
+
+	nextJob = 0;
+	jobsLeft = jobs.size();
+	tStart = timer.GetTime();
+
+	for (int i=0;i<workers.size();i++) {
+		if (!StartWorker(workers[i])) {
+			CACHED_LOGGER("ProcessPool")->Error("Unable to start worker %d", i);
+			for (int j=0;j<i;j++) {
+				StopWorker(workers[j]);
+			}
+			return false;
+		}
+		DispatchJob(workers[i]);
+	}
+
+	std::vector<pollfd> plist;
+	std::vector<int> owner;		// worker index, negative (-1 - idx) for stderr
+	while (jobsLeft > 0) {
+		plist.clear();
+		owner.clear();
+		for (int i=0;i<workers.size();i++) {
+			Process_Unix *process = workers[i]->process;
+			if (process == NULL) {
+				continue;
+			}
+			if (process->pipe_stdout[0] != -1) {
+				pollfd pfd = { process->pipe_stdout[0], POLLIN, 0 };
+				plist.push_back(pfd);
+				owner.push_back(i);
+			}
+			if (process->pipe_stderr[0] != -1) {
+				pollfd pfd = { process->pipe_stderr[0], POLLIN, 0 };
+				plist.push_back(pfd);
+				owner.push_back(-1 - i);
+			}
+		}
+		if (plist.empty()) {
+			CACHED_LOGGER("ProcessPool")->Error("No workers left, %d jobs not processed", jobsLeft);
+			break;
+		}
+
+		int rval = poll(&plist[0], plist.size(), NextTimeout());
+		if (rval < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			CACHED_LOGGER("ProcessPool")->Error("poll: %d, %s", errno, strerror(errno));
+			break;
+		}
+		if (rval == 0) {
+			KillExpiredJobs();
+			continue;
+		}
+		for (int i=0;i<plist.size();i++) {
+			if (!(plist[i].revents & (POLLIN | POLLHUP | POLLERR))) {
+				continue;
+			}
+			if (owner[i] >= 0) {
+				// Pipes of a dead worker are gone (or reused by its respawn), rebuild the poll list
+				if (!OnWorkerData(owner[i], workers[owner[i]])) {
+					break;
+				}
+			} else {
+				DrainStdErr(workers[-1 - owner[i]]);
+			}
+		}
+		KillExpiredJobs();
+	}
+	tEnd = timer.GetTime();
+
+	for (int i=0;i<workers.size();i++) {
+		StopWorker(workers[i]);
+	}
+	return (jobsLeft == 0);
+}
+
+bool ProcessPool::StartWorker(Worker *worker) {
+	worker->process = new Process_Unix();
+	worker->process->withStdIn = true;
+	worker->inbuf.clear();
+	worker->replySize = -1;
+	worker->idxJob = -1;
+	worker->stderrLines.OnProcessStarted();
+
+	if ((!worker->process->PrepareFileDescriptors()) ||
+		(!worker->process->CreatePipes()) ||
+		(!worker->process->Duplicate()) ||
+		(!worker->process->Spawn(command, arguments))) {
+		delete worker->process;
+		worker->process = NULL;
+		return false;
+	}
+	return true;
+}
+
+// Closing stdin is the 'quit' signal for a worker, one that doesn't exit within a second is killed
+void ProcessPool::StopWorker(Worker *worker) {
+	if (worker->process == NULL) {
+		return;
+	}
+	Process_Unix *process = worker->process;
+	process->ClosePipe(process->pipe_stdin);
+	process->ClosePipe(process->pipe_stdout);
+	process->ClosePipe(process->pipe_stderr);
+	worker->stderrLines.OnProcessExit();
+	if (!process->WaitForExit(1000)) {
+		CACHED_LOGGER("ProcessPool")->Warning("Worker pid %d did not exit, killing it", (int)process->pid);
+		kill(process->pid, SIGKILL);
+		process->WaitForExit();
+	}
+	delete process;
+	worker->process = NULL;
+}
+
+bool ProcessPool::DispatchJob(Worker *worker) {
+	if (nextJob >= jobs.size()) {
+		return false;
+	}
+	std::string line = jobs[nextJob] + "\n";
+	size_t written = 0;
+	while (written < line.length()) {
+		ssize_t res = write(worker->process->pipe_stdin[1], line.c_str() + written, line.length() - written);
+		if (res < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			// Worker is gone, EOF on stdout will trigger the respawn
+			return false;
+		}
+		written += res;
+	}
+	worker->idxJob = nextJob;
+	worker->tJobStart = timer.GetTime();
+	nextJob++;
+	return true;
+}
+
+void ProcessPool::Worker::OnStdErrLine(const char *line, size_t len) {
+	CACHED_LOGGER("ProcessPool")->Debug("Worker %d: %.*s", index, (int)len, line);
+}
+
+void ProcessPool::Worker::OnStdOutData(const char *data, size_t len) {
+	pool->OnWorkerReply(this, data, len);
+}
+
+// Returns false if the worker died
+bool ProcessPool::OnWorkerData(int idxWorker, Worker *worker) {
+	if (worker->process->ReadPipe(worker->process->pipe_stdout, true, worker)) {
+		return true;
+	}
+	OnWorkerDied(idxWorker, worker);
+	return false;
+}
+
+//
+// Replies are '<numbytes>\n' + data. A reply within one read is handed out straight from the
+// read buffer, only the header and replies spanning reads are collected in 'inbuf'.
+//
+void ProcessPool::OnWorkerReply(Worker *worker, const char *data, size_t len) {
+	while (len > 0) {
+		if (worker->replySize < 0) {
+			const char *eol = (const char *)memchr(data, '\n', len);
+			if (eol == NULL) {
+				worker->inbuf.append(data, len);
+				return;
+			}
+			worker->inbuf.append(data, eol - data);
+			long numBytes = atol(worker->inbuf.c_str());
+			worker->inbuf.clear();
+			len -= (eol + 1 - data);
+			data = eol + 1;
+			if (numBytes < 0) {
+				ReplyDone(worker, NULL, numBytes);
+				continue;
+			}
+			worker->replySize = numBytes;
+		}
+		if (worker->inbuf.empty() && (len >= (size_t)worker->replySize)) {
+			ReplyDone(worker, data, worker->replySize);
+			data += worker->replySize;
+			len -= worker->replySize;
+		} else {
+			size_t n = std::min(len, (size_t)worker->replySize - worker->inbuf.length());
+			worker->inbuf.append(data, n);
+			data += n;
+			len -= n;
+			if (worker->inbuf.length() < (size_t)worker->replySize) {
+				return;
+			}
+			ReplyDone(worker, worker->inbuf.data(), worker->replySize);
+			worker->inbuf.clear();
+		}
+		worker->replySize = -1;
+	}
+}
+
+// Negative 'numBytes' is a failed job
+void ProcessPool::ReplyDone(Worker *worker, const char *data, long numBytes) {
+	int idxJob = worker->idxJob;
+	worker->idxJob = -1;
+	worker->tBusy += timer.GetTime() - worker->tJobStart;
+	jobsLeft--;
+
+	if (numBytes < 0) {
+		worker->jobsFailed++;
+		if (callback != NULL) {
+			callback->OnJobFailed(idxJob, worker->index);
+		}
+	} else {
+		worker->jobsDone++;
+		if (callback != NULL) {
+			callback->OnJobDone(idxJob, worker->index, data, numBytes);
+		}
+	}
+	DispatchJob(worker);
+}
+
+void ProcessPool::OnWorkerDied(int idxWorker, Worker *worker) {
+	CACHED_LOGGER("ProcessPool")->Warning("Worker %d died, job: %d", idxWorker, worker->idxJob);
+	if (worker->idxJob != -1) {
+		int idxJob = worker->idxJob;
+		worker->idxJob = -1;
+		worker->jobsFailed++;
+		jobsLeft--;
+		if (callback != NULL) {
+			callback->OnJobFailed(idxJob, idxWorker);
+		}
+	}
+	StopWorker(worker);
+
+	if (nextJob < jobs.size()) {
+		worker->respawns++;
+		if (StartWorker(worker)) {
+			DispatchJob(worker);
+		}
+	}
+}
+
+// Poll timeout in ms until the first running job expires, -1 without a job timeout
+int ProcessPool::NextTimeout() {
+	if (jobTimeout <= 0.0) {
+		return -1;
+	}
+	double tNow = timer.GetTime();
+	int timeoutMs = -1;
+	for (int i=0;i<workers.size();i++) {
+		Worker *worker = workers[i];
+		if ((worker->process == NULL) || (worker->idxJob == -1)) {
+			continue;
+		}
+		double tLeft = worker->tJobStart + jobTimeout - tNow;
+		int ms = (tLeft > 0.0) ? ((int)(tLeft * 1000.0) + 1) : 0;
+		if ((timeoutMs < 0) || (ms < timeoutMs)) {
+			timeoutMs = ms;
+		}
+	}
+	return timeoutMs;
+}
+
+// A worker stuck on a job is killed, the job fails and the worker is respawned like one that died
+void ProcessPool::KillExpiredJobs() {
+	if (jobTimeout <= 0.0) {
+		return;
+	}
+	for (int i=0;i<workers.size();i++) {
+		Worker *worker = workers[i];
+		if ((worker->process == NULL) || (worker->idxJob == -1)) {
+			continue;
+		}
+		double tJob = timer.GetTime() - worker->tJobStart;
+		if (tJob < jobTimeout) {
+			continue;
+		}
+		CACHED_LOGGER("ProcessPool")->Warning("Worker %d, job %d timed out after %f sec", i, worker->idxJob, tJob);
+		kill(worker->process->pid, SIGKILL);
+		OnWorkerDied(i, worker);
+	}
+}
+
+void ProcessPool::DrainStdErr(Worker *worker) {
+	worker->process->ReadPipe(worker->process->pipe_stderr, false, &worker->stderrLines);
+}
+
+void ProcessPool::DumpStats() {
+	double tTotal = tEnd - tStart;
+	int totalDone = 0;
+	printf("ProcessPool, %d workers, %d jobs, %f sec\n", (int)workers.size(), (int)jobs.size(), tTotal);
+	for (int i=0;i<workers.size();i++) {
+		Worker *worker = workers[i];
+		double jobsPerSec = (worker->tBusy > 0.0) ? (worker->jobsDone / worker->tBusy) : 0.0;
+		printf("  %d: done: %d, failed: %d, respawns: %d, busy: %f sec, %.2f jobs/sec\n", i,
+			worker->jobsDone, worker->jobsFailed, worker->respawns, worker->tBusy, jobsPerSec);
+		totalDone += worker->jobsDone;
+	}
+	if (tTotal > 0.0) {
+		printf("  total: %.2f jobs/sec\n", totalDone / tTotal);
+	}
+}
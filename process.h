@@ -9,17 +9,22 @@
 
 #include <string>
 #include <list>
+#include <vector>
+#include <thread>
+#include <atomic>
 
+#include "timer.h"
 
 namespace gnilk
 {
 
+	// Data points into the read buffer of the process and is only valid during the call
 	class ProcessCallbackInterface {
 	public:
 		virtual void OnProcessStarted() = 0;
 		virtual void OnProcessExit() = 0;
-		virtual void OnStdOutData(std::string data) = 0;
-		virtual void OnStdErrData(std::string data) = 0;
+		virtual void OnStdOutData(const char *data, size_t len) = 0;
+		virtual void OnStdErrData(const char *data, size_t len) = 0;
 	};
 
 	// empty implementation
@@ -27,14 +32,49 @@ namespace gnilk
 	public:
 		virtual void OnProcessStarted() {}
 		virtual void OnProcessExit() {}
-		virtual void OnStdOutData(std::string data) {}
-		virtual void OnStdErrData(std::string data) {}
+		virtual void OnStdOutData(const char *data, size_t len) {}
+		virtual void OnStdErrData(const char *data, size_t len) {}
+	};
+
+	// Line based output, lines are delivered without the trailing newline
+	class ProcessLineCallbackInterface {
+	public:
+		virtual void OnProcessStarted() {}
+		virtual void OnProcessExit() {}
+		virtual void OnStdOutLine(const char *line, size_t len) = 0;
+		virtual void OnStdErrLine(const char *line, size_t len) = 0;
+	};
+
+	//
+	// Adaptor splitting process output in lines. Complete lines are handed out straight
+	// from the read buffer, only a line spanning two reads is copied to a carry buffer.
+	// The carry buffers keep their capacity, so steady state output does not allocate.
+	//
+	class ProcessLineSplitter : public ProcessCallbackBase {
+	public:
+		ProcessLineSplitter(ProcessLineCallbackInterface *callback);
+		virtual ~ProcessLineSplitter() {}
+
+		virtual void OnProcessStarted();
+		virtual void OnProcessExit();
+		virtual void OnStdOutData(const char *data, size_t len);
+		virtual void OnStdErrData(const char *data, size_t len);
+	private:
+		void Split(std::vector<char> &carry, bool isStdOut, const char *data, size_t len);
+		void Flush(std::vector<char> &carry, bool isStdOut);
+		void Emit(bool isStdOut, const char *line, size_t len);
+	private:
+		ProcessLineCallbackInterface *callback;
+		std::vector<char> carryOut;
+		std::vector<char> carryErr;
 	};
 
 	class Process;
+	class ProcessPool;
 
 	class Process_Unix {
 		friend Process;
+		friend ProcessPool;
 	public:
 		Process_Unix();
 		virtual ~Process_Unix();
@@ -44,9 +84,12 @@ namespace gnilk
 		bool CreatePipes();
 		bool SetNonBlocking();
 		bool Duplicate();
+		bool Spawn(std::string command, std::list<std::string> &arguments);
 		bool SpawnAndLoop(std::string command, std::list<std::string> &arguments, ProcessCallbackBase *callback);
-		void ConsumePipes(ProcessCallbackBase *callback);
-		bool IsFinished();
+		bool ConsumePipes(ProcessCallbackBase *callback);
+		bool ReadPipe(int *filedes, bool isStdOut, ProcessCallbackBase *callback);
+		// With a timeout (ms) false is returned if the child is still running after it
+		bool WaitForExit(int timeoutMs = -1);
 
 		
 		bool CreatePipe(int *pipe);
@@ -54,11 +97,15 @@ namespace gnilk
 		void ClosePipe(int *pipe);
 		
 	private:
+		bool withStdIn;		// child stdin is a pipe we write to, otherwise inherited
+		int pipe_stdin[2];
 		int pipe_stdout[2];
 		int pipe_stderr[2];
 		pid_t pid;
+		int exitStatus;
 		posix_spawn_file_actions_t child_fd_actions;
 		char **argv;
+		std::vector<char> readBuffer;	// reused for every read, callbacks get views into it
 	};
 
 
@@ -72,16 +119,97 @@ namespace gnilk
 		void AddArgument(std::string);
 		void AddArgument(const char *format, ...);
 		bool ExecuteAndWait();
+		// Runs the process on a worker thread, callbacks are invoked from that thread
+		bool ExecuteAsync();
+		bool IsFinished() { return finished; }
+		bool Wait();
+		int ExitStatus() { return process.exitStatus; }
 	public:
 		virtual void OnProcessStarted();
 		virtual void OnProcessExit();
-		virtual void OnStdOutData(std::string data);
-		virtual void OnStdErrData(std::string data);
+		virtual void OnStdOutData(const char *data, size_t len);
+		virtual void OnStdErrData(const char *data, size_t len);
 
 	private:
 		std::string command;
 		std::list<std::string> arguments;
 		Process_Unix process;
 		ProcessCallbackInterface *callback;
+		std::thread worker;
+		std::atomic<bool> finished;
+		bool result;
+	};
+
+	//
+	// Pool of long running worker processes, each worker reads one job per line on stdin
+	// and answers with '<numbytes>\n' followed by numbytes of result data on stdout.
+	// A negative size reports a failed job. Workers that die are respawned, the job
+	// they were running is reported as failed. With a job timeout, a worker still busy
+	// with a job after that long is killed and handled like a worker that died.
+	//
+	// Result data points into the read buffer of the worker and is only valid during the call
+	class ProcessPoolCallbackInterface {
+	public:
+		virtual void OnJobDone(int idxJob, int idxWorker, const char *data, size_t len) = 0;
+		virtual void OnJobFailed(int idxJob, int idxWorker) = 0;
+	};
+
+	class ProcessPool {
+	public:
+		ProcessPool(std::string command, int numWorkers);
+		virtual ~ProcessPool();
+
+		void SetCallback(ProcessPoolCallbackInterface *_callback);
+		void AddArgument(std::string arg);
+		// Seconds a job may take, 0 (default) waits forever
+		void SetJobTimeout(double seconds);
+		int AddJob(std::string job);
+		bool Run();
+		void DumpStats();
+	private:
+		class Worker : public ProcessCallbackBase, public ProcessLineCallbackInterface {
+		public:
+			ProcessPool *pool;
+			int index;
+			Process_Unix *process;
+			int idxJob;			// job in progress, -1 when idle
+			std::string inbuf;	// reply header or a reply spanning reads, keeps its capacity
+			ProcessLineSplitter stderrLines;
+			long replySize;		// size of the reply being read, -1 while reading the header
+			int jobsDone;
+			int jobsFailed;
+			int respawns;
+			double tBusy;
+			double tJobStart;
+		public:
+			Worker(ProcessPool *pool, int index);
+			virtual ~Worker() {}
+			virtual void OnStdOutData(const char *data, size_t len);
+			virtual void OnStdOutLine(const char *line, size_t len) {}
+			virtual void OnStdErrLine(const char *line, size_t len);
+		};
+
+		bool StartWorker(Worker *worker);
+		void StopWorker(Worker *worker);
+		bool DispatchJob(Worker *worker);
+		bool OnWorkerData(int idxWorker, Worker *worker);
+		void OnWorkerDied(int idxWorker, Worker *worker);
+		int NextTimeout();
+		void KillExpiredJobs();
+		void OnWorkerReply(Worker *worker, const char *data, size_t len);
+		void ReplyDone(Worker *worker, const char *data, long numBytes);
+		void DrainStdErr(Worker *worker);
+	private:
+		std::string command;
+		std::list<std::string> arguments;
+		std::vector<std::string> jobs;
+		std::vector<Worker *> workers;
+		ProcessPoolCallbackInterface *callback;
+		int nextJob;
+		int jobsLeft;
+		double jobTimeout;
+		Timer timer;
+		double tStart;
+		double tEnd;
 	};
 }
\ No newline at end of file
@@ -12,6 +12,14 @@ go run contour.go -m -gl 128 -cnt 4 -cns 64 -lca 0.97 -oca 0.98 -ccd 16 -bs 16 ~
 # go run contour.go -w 255 -oca 0.95 ~gnilk/Downloads/tmpout/ strips_0.95.db
 # go run contour.go -w 255 -oca 0.97 ~gnilk/Downloads/tmpout/ strips_0.97.db
 
+# same oca sweep in one pass, frames are decoded and scanned once for all presets
+# ./player -s 0 sweep_oca.ini ~gnilk/Downloads/tmpout/*.png
+
+# trace straight from ffmpeg, no png files in between
+# ffmpeg -i ~gnilk/Downloads/clip.mp4 -pix_fmt gray -f yuv4mpegpipe - | ./player -v strips_stream.db -
+
 #go run contour.go -e -w 255 -oca 0.95 -datamode int8 ~gnilk/Downloads/tmpout/ segdir_opt_int8/
 #go run contour.go -r -w 256 -h 256 -datamode int8 strips.db strip_images/
 #ffmpeg -i strip_images/image_%d.png video_0.95_full.avi
+# same without the png files
+# ./player -x strips.db - | ffmpeg -i - video_0.95_full.avi
@@ -5,7 +5,14 @@
 //
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <vector>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <condition_variable>
 #include <math.h>
 
 #include <imgui.h>
@@ -20,6 +27,10 @@
 #include "logger.h"
 #include "process.h"
 #include "contour.h"
+#include "timer.h"
+#include "inifile.h"
+#include "tiletrace.h"
+#include "videoio.h"
 
 using namespace gnilk;
 using namespace gnilk::contour;
@@ -122,38 +133,1128 @@ static ImageController imageController;
 
 #define UI_MODE 1
 #define GEN_MODE 2
+#define WORKER_MODE 3
+#define POOL_MODE 4
+#define BENCH_MODE 5
+#define SWEEP_MODE 6
+#define TILE_MODE 7
+#define VIDEO_MODE 8
+#define EXPORT_MODE 9
+
+//
+// Micro benchmarks, run with 'player -b'
+//
+static void BenchLogger() {
+	const int numCalls = 10000000;
+	Timer timer;
+	Logger::Initialize();
+	int oldLevel = Logger::GetProperties()->GetDebugLevel();
+	// Debug disabled, measures the cost of a rejected call
+	Logger::GetProperties()->SetDebugLevel(Logger::kMCInfo);
+
+	double tStart = timer.GetTime();
+	for (int i=0;i<numCalls;i++) {
+		Logger::GetLogger("BenchLogger")->Debug("value: %d", i);
+	}
+	double tLookup = timer.GetTime() - tStart;
+
+	tStart = timer.GetTime();
+	for (int i=0;i<numCalls;i++) {
+		CACHED_LOGGER("BenchLogger")->Debug("value: %d", i);
+	}
+	double tCached = timer.GetTime() - tStart;
+
+	Logger::GetProperties()->SetDebugLevel(oldLevel);
+	printf("Logger, disabled level, %d calls\n", numCalls);
+	printf("  GetLogger per call: %f sec, %.2f ns/call\n", tLookup, 1e9 * tLookup / numCalls);
+	printf("  Cached handle     : %f sec, %.2f ns/call\n", tCached, 1e9 * tCached / numCalls);
+}
+
+// Text line to a file sink vs. the same data as a structured event to the binary sink
+static void BenchLogEvents() {
+	const int numCalls = 1000000;
+	// Above the tracer's event ids (contour.cpp)
+	const int kBenchEvent_LineCutOff = 1000;
+	Timer timer;
+	Logger::Initialize();
+	int prevLevel = Logger::GetProperties()->GetDebugLevel();
+	Logger::GetProperties()->SetDebugLevel(Logger::kMCDebug);
+
+	char *args[] = { (char *)"file", (char *)"bench_text.log" };
+	ILogOutputSink *textSink = Logger::CreateSink("LogBufferedFileSink");
+	Logger::AddSink(textSink, "bench", 2, args);
+	Logger::SetAllSinkDebugLevel(Logger::kMCDebug);
+	double tStart = timer.GetTime();
+	for (int i=0;i<numCalls;i++) {
+		LOG_DEBUG(CACHED_LOGGER("BenchEvents"), "NewSegment, lineCutOff, iter: %d, %d -> %d, dist: %f, dp: %f", i, i+1, i+2, 1.5, 0.75);
+	}
+	double tText = timer.GetTime() - tStart;
+	Logger::SetAllSinkDebugLevel(Logger::kMCNone + 1000);	// mute, sinks can't be removed
+
+	LogBinaryFileSink binarySink;
+	binarySink.Open("bench_binary.blog");
+	Logger::AddRecordSink(&binarySink);
+	Logger::RegisterEvent(kBenchEvent_LineCutOff, "LineCutOff", "iter,idxStart,idxPrevious,dist,dp");
+	tStart = timer.GetTime();
+	for (int i=0;i<numCalls;i++) {
+		LOG_EVENT(CACHED_LOGGER("BenchEvents"), Logger::kMCDebug, kBenchEvent_LineCutOff, i, i+1, i+2, 1.5, 0.75);
+	}
+	double tBinary = timer.GetTime() - tStart;
+
+	// The following benchmarks must neither write events nor pay for them
+	Logger::RemoveRecordSink(&binarySink);
+	binarySink.Close();
+	Logger::GetProperties()->SetDebugLevel(prevLevel);
+
+	printf("Log events, %d calls\n", numCalls);
+	printf("  Text, buffered file sink: %f sec, %.2f ns/call\n", tText, 1e9 * tText / numCalls);
+	printf("  Binary record sink      : %f sec, %.2f ns/call\n", tBinary, 1e9 * tBinary / numCalls);
+}
+
+// Parse a ~10MB parameter sweep file and look up every value once
+static void BenchIniFile() {
+	const char *names[] = { "gl", "bs", "cnt", "cns", "lcd", "lca", "lld", "ccd", "oca" };
+	const int numNames = sizeof(names) / sizeof(names[0]);
+	Timer timer;
+
+	std::string data;
+	char line[64];
+	int numPresets = 0;
+	while(data.length() < 10 * 1024 * 1024) {
+		snprintf(line, sizeof(line), "[preset_%d]\n", numPresets);
+		data.append(line);
+		for (int i=0;i<numNames;i++) {
+			snprintf(line, sizeof(line), "%s=%f\n", names[i], numPresets * 0.01 + i);
+			data.append(line);
+		}
+		numPresets++;
+	}
+	size_t numBytes = data.length();
+
+	double tStart = timer.GetTime();
+	inifile::SectionContainer settings;
+	settings.FromBuffer(std::move(data));
+	double tParse = timer.GetTime() - tStart;
+
+	int numFound = 0;
+	tStart = timer.GetTime();
+	for (int i=0;i<numPresets;i++) {
+		snprintf(line, sizeof(line), "preset_%d", i);
+		for (int j=0;j<numNames;j++) {
+			inifile::StringRef value;
+			if (settings.GetValue(line, names[j], value)) {
+				numFound++;
+			}
+		}
+	}
+	double tLookup = timer.GetTime() - tStart;
+
+	printf("IniFile, %d presets, %d bytes\n", numPresets, (int)numBytes);
+	printf("  Parse : %f sec, %.2f MB/sec\n", tParse, numBytes / (tParse * 1024 * 1024));
+	printf("  Lookup: %f sec, %.2f ns/value (%d found)\n", tLookup, 1e9 * tLookup / (numPresets * numNames), numFound);
+}
+
+// Distance sort vs. chain code extraction on the same contour points, switching
+// engine each run invalidates the extraction stage only, the scan is done once
+static void BenchExtraction() {
+	const int numRuns = 20;
+	const char *engineNames[] = { "Distance sort", "Chain code   " };
+	Timer timer;
+
+	Bitmap *bitmap = Bitmap::LoadPNGImage(std::string("image.png"));
+	if (bitmap == NULL) {
+		printf("Extraction, unable to load 'image.png', skipping\n");
+		return;
+	}
+	Trace tracer;
+	tracer.SetImage(bitmap->Buffer(), bitmap->Width(), bitmap->Height());
+	delete bitmap;
+	tracer.Update();
+
+	double tEngine[2] = { 0.0, 0.0 };
+	int numSegments[2] = { 0, 0 };
+	int numOptSegments[2] = { 0, 0 };
+	for (int i=0;i<numRuns;i++) {
+		for (int engine=0;engine<2;engine++) {
+			Config config = tracer.GetConfig();
+			config.Engine = (ExtractionEngine)engine;
+			tracer.SetConfig(config);
+			double tStart = timer.GetTime();
+			tracer.Update();
+			tEngine[engine] += timer.GetTime() - tStart;
+			numSegments[engine] = tracer.LineSegments().size();
+			numOptSegments[engine] = tracer.OptimizedSegments().size();
+		}
+	}
+
+	printf("Extraction + optimization, %d contour points, %d runs\n", (int)tracer.ContourPoints().size(), numRuns);
+	for (int engine=0;engine<2;engine++) {
+		printf("  %s: %f sec, %.3f ms/run, segments: %d, optimized: %d\n", engineNames[engine],
+			tEngine[engine], 1000.0 * tEngine[engine] / numRuns, numSegments[engine], numOptSegments[engine]);
+	}
+}
+
+// Full trace of image.png, point based engines at full resolution vs. iso-lines on a downscaled plane
+static void BenchIsoLine() {
+	const int numRuns = 10;
+	const ExtractionEngine engines[] = { kEngine_DistanceSort, kEngine_ChainCode, kEngine_IsoLine, kEngine_IsoLine, kEngine_IsoLine };
+	const int downscale[] = { 1, 1, 1, 2, 4 };
+	const char *engineNames[] = { "Distance sort", "Chain code", "Iso line" };
+	Timer timer;
+
+	Bitmap *bitmap = Bitmap::LoadPNGImage(std::string("image.png"));
+	if (bitmap == NULL) {
+		printf("IsoLine, unable to load 'image.png', skipping\n");
+		return;
+	}
+	printf("Full trace, %dx%d, %d runs\n", bitmap->Width(), bitmap->Height(), numRuns);
+	for (int i=0;i<sizeof(engines)/sizeof(engines[0]);i++) {
+		Trace tracer;
+		Config config = tracer.GetConfig();
+		config.Engine = engines[i];
+		config.Downscale = downscale[i];
+		tracer.SetConfig(config);
+		double tStart = timer.GetTime();
+		for (int j=0;j<numRuns;j++) {
+			tracer.SetImage(bitmap->Buffer(), bitmap->Width(), bitmap->Height());
+			tracer.Update();
+		}
+		double tTrace = timer.GetTime() - tStart;
+		printf("  %-13s 1/%d: %.3f ms/run, segments: %d, optimized: %d\n", engineNames[engines[i]], downscale[i],
+			1000.0 * tTrace / numRuns, (int)tracer.LineSegments().size(), (int)tracer.OptimizedSegments().size());
+	}
+	delete bitmap;
+}
+
+// Contrast + grey conversion as the Go tracer does it, pow per channel per pixel followed by the
+// GrayModel weighting, vs. the LUT fused with the SIMD luma conversion of the scan stage
+static void BenchLuma() {
+	const int numRuns = 10;
+	const float factor = 4.0f;
+	const float scale = 64.0f;
+	Timer timer;
+
+	Bitmap *bitmap = Bitmap::LoadPNGImage(std::string("image.png"));
+	if (bitmap == NULL) {
+		printf("Luma, unable to load 'image.png', skipping\n");
+		return;
+	}
+	int numPixels = bitmap->Width() * bitmap->Height();
+	std::vector<uint8_t> reference(numPixels);
+
+	double tStart = timer.GetTime();
+	for (int i=0;i<numRuns;i++) {
+		const unsigned char *in = bitmap->Buffer();
+		for (int j=0;j<numPixels;j++) {
+			uint32_t rgb[3];
+			for (int c=0;c<3;c++) {
+				double v = pow((double)in[j*4+c] / 255.0, (double)factor) * scale * 255.0;
+				rgb[c] = (uint32_t)std::max(0.0, std::min(v, 255.0)) * 0x101;
+			}
+			reference[j] = (uint8_t)((19595 * rgb[0] + 38470 * rgb[1] + 7471 * rgb[2] + (1 << 15)) >> 24);
+		}
+	}
+	double tPow = timer.GetTime() - tStart;
+
+	LumaPlane luma;
+	tStart = timer.GetTime();
+	for (int i=0;i<numRuns;i++) {
+		uint8_t lut[256];
+		Trace::BuildContrastLut(lut, factor, scale);
+		luma.FromRGBA(bitmap, lut);
+	}
+	double tLut = timer.GetTime() - tStart;
+	bool identical = (memcmp(luma.Buffer(), reference.data(), numPixels) == 0);
+
+	tStart = timer.GetTime();
+	for (int i=0;i<numRuns;i++) {
+		luma.FromRGBA(bitmap);
+	}
+	double tLuma = timer.GetTime() - tStart;
+
+	printf("Luma, %dx%d, cnt=%.1f cns=%.1f, %d runs\n", bitmap->Width(), bitmap->Height(), factor, scale, numRuns);
+	printf("  pow per channel + grey: %.3f ms/frame\n", 1000.0 * tPow / numRuns);
+	printf("  LUT + SIMD luma       : %.3f ms/frame, %.1fx, %s\n", 1000.0 * tLut / numRuns, tPow / tLut,
+		identical ? "identical" : "MISMATCH");
+	printf("  SIMD luma, no contrast: %.3f ms/frame\n", 1000.0 * tLuma / numRuns);
+	delete bitmap;
+}
+
+// 5x5 box filter of the grey channel, turns the sharp edges of image.png into soft ones
+static Bitmap *SoftenEdges(Bitmap *src) {
+	const int radius = 2;
+	Bitmap *dst = Bitmap::FromRGBA(src->Width(), src->Height(), src->Buffer());
+	for (int y=0;y<src->Height();y++) {
+		for (int x=0;x<src->Width();x++) {
+			int sum = 0;
+			int n = 0;
+			for (int dy=-radius;dy<=radius;dy++) {
+				for (int dx=-radius;dx<=radius;dx++) {
+					if (src->Inside(x + dx, y + dy)) {
+						sum += src->Buffer(x + dx, y + dy)[0];
+						n++;
+					}
+				}
+			}
+			unsigned char *pixel = dst->Buffer(x, y);
+			pixel[0] = pixel[1] = pixel[2] = (unsigned char)(sum / n);
+		}
+	}
+	return dst;
+}
+
+// Full trace with and without thinning of the contour points, image.png as is and with soft edges
+static void BenchThinning() {
+	const int numRuns = 10;
+	const char *engineNames[] = { "Distance sort", "Chain code   " };
+	Timer timer;
+
+	Bitmap *bitmap = Bitmap::LoadPNGImage(std::string("image.png"));
+	if (bitmap == NULL) {
+		printf("Thinning, unable to load 'image.png', skipping\n");
+		return;
+	}
+	Bitmap *images[2] = { bitmap, SoftenEdges(bitmap) };
+	const char *imageNames[2] = { "sharp", "soft" };
+	const int greyLevels[2] = { Trace::DefaultConfig().GreyThresholdLevel, 16 };
+
+	printf("Thinning, full trace, %dx%d, %d runs\n", bitmap->Width(), bitmap->Height(), numRuns);
+	for (int img=0;img<2;img++) {
+		for (int engine=0;engine<2;engine++) {
+			for (int thinning=0;thinning<2;thinning++) {
+				Trace tracer;
+				Config config = tracer.GetConfig();
+				config.Engine = (ExtractionEngine)engine;
+				config.GreyThresholdLevel = greyLevels[img];
+				config.Thinning = (thinning != 0);
+				tracer.SetConfig(config);
+				double tStart = timer.GetTime();
+				for (int i=0;i<numRuns;i++) {
+					tracer.SetImage(images[img]->Buffer(), images[img]->Width(), images[img]->Height());
+					tracer.Update();
+				}
+				double tTrace = timer.GetTime() - tStart;
+				printf("  %-5s gl=%-3d %s thinning %-3s: %.3f ms/run, points: %d, segments: %d, optimized: %d\n",
+					imageNames[img], greyLevels[img], engineNames[engine], thinning ? "on" : "off",
+					1000.0 * tTrace / numRuns, (int)tracer.ContourPoints().size(),
+					(int)tracer.LineSegments().size(), (int)tracer.OptimizedSegments().size());
+			}
+		}
+	}
+	delete images[1];
+	delete bitmap;
+}
+
+// Same segment coordinates in the same order
+static bool SameSegments(std::vector<LineSegment *> &a, std::vector<LineSegment *> &b) {
+	if (a.size() != b.size()) {
+		return false;
+	}
+	for (int i=0;i<a.size();i++) {
+		if (!a[i]->Start().IsEqual(b[i]->Start()) || !a[i]->End().IsEqual(b[i]->End())) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Sequences where only a 64x64 patch or a few single pixels change per frame, full trace per frame
+// vs. SetFrame which only re-scans the blocks the change touches. Both must give the same strips.
+static void BenchSequence() {
+	const int numFrames = 30;
+	const int patchSize = 64;
+	const int numBlocks = 64;
+	const char *engineNames[] = { "Distance sort", "Chain code   " };
+	const char *changeNames[] = { "patch ", "pixels" };
+	Timer timer;
+
+	Bitmap *bitmap = Bitmap::LoadPNGImage(std::string("image.png"));
+	if (bitmap == NULL) {
+		printf("Sequence, unable to load 'image.png', skipping\n");
+		return;
+	}
+	if ((bitmap->Width() <= patchSize) || (bitmap->Height() <= patchSize)) {
+		printf("Sequence, 'image.png' smaller than the patch, skipping\n");
+		delete bitmap;
+		return;
+	}
+	printf("Sequence, %dx%d, %d frames, %dx%d patch or 2 pixels in %d blocks changed per frame\n", bitmap->Width(),
+		bitmap->Height(), numFrames, patchSize, patchSize, numBlocks);
+	for (int engine=0;engine<2;engine++) {
+		for (int change=0;change<2;change++) {
+			Bitmap *frame = Bitmap::FromRGBA(bitmap->Width(), bitmap->Height(), bitmap->Buffer());
+			Trace fullTracer;
+			Trace frameTracer;
+			Config config = fullTracer.GetConfig();
+			config.Engine = (ExtractionEngine)engine;
+			if (change == 1) {
+				// Pixel values straight to the luma plane
+				config.ContrastFactor = 1.0f;
+				config.ContrastScale = 1.0f;
+			}
+			fullTracer.SetConfig(config);
+			frameTracer.SetConfig(config);
+
+			double tFull = 0.0;
+			double tFrame = 0.0;
+			int numMismatch = 0;
+			unsigned int seed = 1;
+			for (int i=0;i<numFrames;i++) {
+				int px = (i * 37) % (frame->Width() - patchSize);
+				int py = (i * 53) % (frame->Height() - patchSize);
+				if (change == 0) {
+					for (int y=0;y<patchSize;y++) {
+						for (int x=0;x<patchSize;x++) {
+							unsigned char *pixel = frame->Buffer(px + x, py + y);
+							pixel[0] = pixel[1] = pixel[2] = (unsigned char)((x * y + i * 7) & 255);
+						}
+					}
+				} else {
+					// Only column 7 of rows 0 and 1 of a block, a weak hash of the block pixels can miss
+					// such a change
+					for (int k=0;k<numBlocks;k++) {
+						int x = (k * 97 % (frame->Width() / 8)) * 8 + 7;
+						int y = (k * 61 % (frame->Height() / 8)) * 8;
+						for (int row=0;row<2;row++) {
+							seed = seed * 1103515245u + 12345u;
+							unsigned char *pixel = frame->Buffer(x, y + row);
+							pixel[0] = pixel[1] = pixel[2] = (unsigned char)(seed >> 24);
+						}
+					}
+				}
+				double tStart = timer.GetTime();
+				fullTracer.SetImage(frame->Buffer(), frame->Width(), frame->Height());
+				fullTracer.Update();
+				tFull += timer.GetTime() - tStart;
+
+				tStart = timer.GetTime();
+				frameTracer.SetFrame(frame->Buffer(), frame->Width(), frame->Height());
+				frameTracer.Update();
+				tFrame += timer.GetTime() - tStart;
+
+				if (!SameSegments(frameTracer.OptimizedSegments(), fullTracer.OptimizedSegments()) ||
+					(frameTracer.ContourPoints().size() != fullTracer.ContourPoints().size())) {
+					numMismatch++;
+				}
+			}
+			printf("  %s %s SetImage: %.3f ms/frame, SetFrame: %.3f ms/frame, mismatches: %d\n", engineNames[engine],
+				changeNames[change], 1000.0 * tFull / numFrames, 1000.0 * tFrame / numFrames, numMismatch);
+			delete frame;
+		}
+	}
+	delete bitmap;
+}
+
+//
+// Whole image vs tiles, image.png repeated to a large canvas
+//
+static void BenchTiled() {
+	const int repeat = 4;
+	const int tileSize = 256;
+	Timer timer;
+	Bitmap *bitmap = Bitmap::LoadPNGImage(std::string("image.png"));
+	if (bitmap == NULL) {
+		printf("Tiled, unable to load 'image.png', skipping\n");
+		return;
+	}
+	int width = bitmap->Width() * repeat;
+	int height = bitmap->Height() * repeat;
+	std::vector<unsigned char> canvas(width * height * 4);
+	for (int y=0;y<height;y++) {
+		for (int rx=0;rx<repeat;rx++) {
+			memcpy(&canvas[(y * width + rx * bitmap->Width()) * 4], bitmap->Buffer(0, y % bitmap->Height()), bitmap->Width() * 4);
+		}
+	}
+	Bitmap *large = Bitmap::FromRGBA(width, height, &canvas[0]);
+	printf("Tiled, %dx%d, tile size: %d\n", width, height, tileSize);
+
+	Trace tracer;
+	double tStart = timer.GetTime();
+	tracer.SetImage(large->Buffer(), width, height);
+	tracer.Update();
+	double tFull = timer.GetTime() - tStart;
+	printf("  Whole image: %.3f sec, segments: %d\n", tFull, (int)tracer.OptimizedSegments().size());
+
+	BitmapTileSource source(large);
+	int maxThreads = std::max(1, (int)std::thread::hardware_concurrency());
+	for (int numThreads=1;numThreads<=maxThreads;numThreads*=2) {
+		TiledTrace tiled(&source, tracer.GetConfig(), tileSize);
+		tStart = timer.GetTime();
+		tiled.Run(numThreads);
+		double tTiled = timer.GetTime() - tStart;
+		printf("  Tiled, %d threads: %.3f sec, %.1fx, tiles: %d, segments: %d, welded: %d, strips: %d\n", numThreads,
+			tTiled, tFull / tTiled, tiled.NumTiles(), tiled.NumSegments(), tiled.NumWelded(), (int)tiled.Strips().size());
+	}
+	delete large;
+	delete bitmap;
+}
+
+static void RunBenchmarks() {
+	BenchLogger();
+	BenchLogEvents();
+	BenchIniFile();
+	BenchExtraction();
+	BenchIsoLine();
+	BenchLuma();
+	BenchThinning();
+	BenchSequence();
+	BenchTiled();
+}
+
+//
+// Worker side of the process pool, reads one png filename per line on stdin and replies
+// with '<numbytes>\n' + the optimized strips of that frame. stdout is reserved for the
+// replies, everything the tracer prints goes to stderr.
+//
+static void RunTraceWorker() {
+	FILE *reply = fdopen(dup(1), "w");
+	dup2(2, 1);
+
+	Trace tracer;
+	char line[1024];
+	while(fgets(line, sizeof(line), stdin) != NULL) {
+		line[strcspn(line, "\r\n")] = '\0';
+		Bitmap *bitmap = Bitmap::LoadPNGImage(std::string(line));
+		if (bitmap == NULL) {
+			fprintf(reply, "-1\n");
+			fflush(reply);
+			continue;
+		}
+		tracer.SetFrame(bitmap->Buffer(), bitmap->Width(), bitmap->Height());
+		tracer.Update();
+		delete bitmap;
+
+		std::string data;
+		Trace::SerializeStrips(data, tracer.OptimizedStrips());
+		fprintf(reply, "%d\n", (int)data.length());
+		fwrite(data.c_str(), 1, data.length(), reply);
+		fflush(reply);
+	}
+	fclose(reply);
+}
+
+class PoolFrameCollector : public ProcessPoolCallbackInterface {
+public:
+	PoolFrameCollector(int numFrames) : frames(numFrames), done(numFrames, false) {}
+	virtual void OnJobDone(int idxJob, int idxWorker, const char *data, size_t len) {
+		frames[idxJob].assign(data, len);
+		done[idxJob] = true;
+	}
+	virtual void OnJobFailed(int idxJob, int idxWorker) {
+		done[idxJob] = false;
+	}
+public:
+	std::vector<std::string> frames;
+	std::vector<bool> done;		// false for failed frames and frames the pool never got to
+};
+
+//
+// Traces a list of frames in parallel using worker processes, the frames are
+// written in order to one .db file, failed frames are left out. Exits with 1 if
+// any frame is missing.
+//
+static void RunTracePool(char *self, int numWorkers, char *dbFile, std::vector<char *> &pngFiles) {
+	ProcessPool pool(self, numWorkers);
+	pool.AddArgument("-w");
+	// A frame traces in well under a second, a worker still busy after a minute is stuck
+	pool.SetJobTimeout(60.0);
+	for (int i=0;i<pngFiles.size();i++) {
+		pool.AddJob(pngFiles[i]);
+	}
+	PoolFrameCollector collector(pngFiles.size());
+	pool.SetCallback(&collector);
+	bool completed = pool.Run();
+
+	FILE *f = fopen(dbFile, "w");
+	if (f == NULL) {
+		perror("Unable to open output file");
+		exit(1);
+	}
+	int nFailed = 0;
+	for (int i=0;i<collector.frames.size();i++) {
+		if (!collector.done[i]) {
+			printf("Frame %d failed: %s\n", i, pngFiles[i]);
+			nFailed++;
+			continue;
+		}
+		fwrite(collector.frames[i].c_str(), 1, collector.frames[i].length(), f);
+	}
+	fclose(f);
+	printf("Frames: %d, failed: %d\n", (int)pngFiles.size(), nFailed);
+	pool.DumpStats();
+	if (!completed || (nFailed > 0)) {
+		exit(1);
+	}
+}
+
+//
+// Parameter sweep, each section in the preset file is one tracing configuration:
+//
+//   [oca_0.97]
+//   file=strips_0.97.db
+//   oca=0.97
+//   ccd=16
+//
+// Missing values use the tracer defaults, 'file' defaults to '<section>.db'.
+// 'engine=1' selects the chain code extraction, 'engine=2' iso-lines on a 1/'ds' plane.
+// 'thin=1' thins the contour to one point across the edge before extraction.
+// A frame that fails to decode is written as an empty frame and the sweep exits with 1.
+//
+struct SweepPreset {
+	std::string name;
+	std::string dbFile;
+	Config config;
+	FILE *f;
+	size_t numBytes;
+};
+
+//
+// Writes the frames of all presets in frame order as they complete. Frames finished ahead of
+// the next one to write are parked here, a thread waits before taking a frame more than
+// 'window' frames ahead, so only about 'window' frames of each preset are held in memory.
+//
+class SweepWriter {
+public:
+	SweepWriter(std::vector<SweepPreset> *presets, int window) : presets(presets), window(window), nextToWrite(0) {}
+	void WaitForSlot(int idxFrame) {
+		std::unique_lock<std::mutex> guard(lock);
+		written.wait(guard, [this, idxFrame]() { return idxFrame < (nextToWrite + window); });
+	}
+	// One serialized frame per preset, taken over by the writer
+	void FrameDone(int idxFrame, std::vector<std::string> &frames, bool isFailed) {
+		std::unique_lock<std::mutex> guard(lock);
+		if (isFailed) {
+			failed.push_back(idxFrame);
+		}
+		pending[idxFrame].swap(frames);
+		while(!pending.empty() && (pending.begin()->first == nextToWrite)) {
+			std::vector<std::string> &data = pending.begin()->second;
+			for (int i=0;i<presets->size();i++) {
+				SweepPreset &preset = presets->at(i);
+				fwrite(data[i].c_str(), 1, data[i].length(), preset.f);
+				preset.numBytes += data[i].length();
+			}
+			pending.erase(pending.begin());
+			nextToWrite++;
+		}
+		written.notify_all();
+	}
+	std::vector<int> &Failed() { return failed; }
+private:
+	std::vector<SweepPreset> *presets;
+	int window;
+	int nextToWrite;
+	std::map<int, std::vector<std::string> > pending;
+	std::vector<int> failed;
+	std::mutex lock;
+	std::condition_variable written;
+};
+
+// Per thread totals, indexed by preset
+struct SweepStats {
+	std::vector<int> numSegments;
+	std::vector<int> numStrips;
+	std::vector<int> numScans;
+	std::vector<double> tTrace;
+	double tDecode;
+};
+
+static float SweepValue(inifile::SectionContainer &settings, const std::string &section, const char *name, float defaultValue) {
+	inifile::StringRef value;
+	if (!settings.GetValue(section, name, value)) {
+		return defaultValue;
+	}
+	return (float)atof(value.ToString().c_str());
+}
+
+static bool LoadSweepPresets(const char *iniFile, std::vector<SweepPreset> &presets) {
+	FILE *f = fopen(iniFile, "r");
+	if (f == NULL) {
+		perror("Unable to open preset file");
+		return false;
+	}
+	std::string data;
+	char buffer[4096];
+	size_t nRead;
+	while((nRead = fread(buffer, 1, sizeof(buffer), f)) > 0) {
+		data.append(buffer, nRead);
+	}
+	fclose(f);
+
+	inifile::SectionContainer settings;
+	settings.FromBuffer(std::move(data));
+	std::vector<std::string> names;
+	settings.GetSectionNames(names);
+
+	Config defaults = Trace::DefaultConfig();
+	for (int i=0;i<names.size();i++) {
+		SweepPreset preset;
+		preset.name = names[i];
+		preset.dbFile = settings.GetValue(names[i], "file", names[i] + ".db");
+		preset.config = defaults;
+		preset.config.GreyThresholdLevel = (uint8_t)SweepValue(settings, names[i], "gl", defaults.GreyThresholdLevel);
+		preset.config.BlockSize = (int)SweepValue(settings, names[i], "bs", defaults.BlockSize);
+		preset.config.ContrastFactor = SweepValue(settings, names[i], "cnt", defaults.ContrastFactor);
+		preset.config.ContrastScale = SweepValue(settings, names[i], "cns", defaults.ContrastScale);
+		preset.config.LineCutOffDistance = SweepValue(settings, names[i], "lcd", defaults.LineCutOffDistance);
+		preset.config.LineCutOffAngle = SweepValue(settings, names[i], "lca", defaults.LineCutOffAngle);
+		preset.config.LongLineDistance = SweepValue(settings, names[i], "lld", defaults.LongLineDistance);
+		preset.config.ClusterCutOffDistance = SweepValue(settings, names[i], "ccd", defaults.ClusterCutOffDistance);
+		preset.config.OptimizationCutOffAngle = SweepValue(settings, names[i], "oca", defaults.OptimizationCutOffAngle);
+		preset.config.Engine = (ExtractionEngine)(int)SweepValue(settings, names[i], "engine", defaults.Engine);
+		preset.config.Downscale = (int)SweepValue(settings, names[i], "ds", defaults.Downscale);
+		preset.config.Thinning = SweepValue(settings, names[i], "thin", defaults.Thinning) != 0.0f;
+		presets.push_back(preset);
+	}
+	return true;
+}
+
+// Orders presets so that consecutive configurations share as many cached trace stages as possible
+static bool SweepOrderLess(const Config &a, const Config &b) {
+	if (a.GreyThresholdLevel != b.GreyThresholdLevel) return a.GreyThresholdLevel < b.GreyThresholdLevel;
+	if (a.BlockSize != b.BlockSize) return a.BlockSize < b.BlockSize;
+	if (a.Downscale != b.Downscale) return a.Downscale < b.Downscale;
+	if (a.Thinning != b.Thinning) return a.Thinning < b.Thinning;
+	if (a.ContrastFactor != b.ContrastFactor) return a.ContrastFactor < b.ContrastFactor;
+	if (a.ContrastScale != b.ContrastScale) return a.ContrastScale < b.ContrastScale;
+	if (a.ClusterCutOffDistance != b.ClusterCutOffDistance) return a.ClusterCutOffDistance < b.ClusterCutOffDistance;
+	if (a.LineCutOffDistance != b.LineCutOffDistance) return a.LineCutOffDistance < b.LineCutOffDistance;
+	if (a.LineCutOffAngle != b.LineCutOffAngle) return a.LineCutOffAngle < b.LineCutOffAngle;
+	if (a.LongLineDistance != b.LongLineDistance) return a.LongLineDistance < b.LongLineDistance;
+	if (a.Engine != b.Engine) return a.Engine < b.Engine;
+	return a.OptimizationCutOffAngle < b.OptimizationCutOffAngle;
+}
+
+//
+// Each thread owns a trace session and takes the next frame, the frame is decoded once and
+// all presets are run on it. The session only re-runs the stages a preset change affects,
+// so the contour scan is done once per frame unless presets differ in 'gl', 'bs' or contrast.
+//
+static void SweepThread(Trace *tracer, std::vector<SweepPreset> *presets, std::vector<int> *order,
+						std::vector<char *> *pngFiles, std::atomic<int> *nextFrame, SweepWriter *writer, SweepStats *stats) {
+	Timer timer;
+	int idxFrame;
+	while((idxFrame = (*nextFrame)++) < pngFiles->size()) {
+		writer->WaitForSlot(idxFrame);
+		std::vector<std::string> frames(presets->size());
+		double tStart = timer.GetTime();
+		Bitmap *bitmap = Bitmap::LoadPNGImage(std::string(pngFiles->at(idxFrame)));
+		if (bitmap == NULL) {
+			// Empty frame (no strips), keeps the following frames in place
+			for (int i=0;i<frames.size();i++) {
+				frames[i].assign(1, '\0');
+			}
+			writer->FrameDone(idxFrame, frames, true);
+			continue;
+		}
+		tracer->SetFrame(bitmap->Buffer(), bitmap->Width(), bitmap->Height());
+		delete bitmap;
+		stats->tDecode += timer.GetTime() - tStart;
+
+		for (int i=0;i<order->size();i++) {
+			int idxPreset = order->at(i);
+			SweepPreset &preset = presets->at(idxPreset);
+			tStart = timer.GetTime();
+			tracer->SetConfig(preset.config);
+			if (tracer->Update() == Trace::kStage_Scan) {
+				stats->numScans[idxPreset]++;
+			}
+			Trace::SerializeStrips(frames[idxPreset], tracer->OptimizedStrips());
+			stats->tTrace[idxPreset] += timer.GetTime() - tStart;
+			stats->numSegments[idxPreset] += tracer->OptimizedSegments().size();
+			stats->numStrips[idxPreset] += tracer->OptimizedStrips().size();
+		}
+		writer->FrameDone(idxFrame, frames, false);
+	}
+}
+
+static void RunTraceSweep(int numThreads, char *iniFile, std::vector<char *> &pngFiles) {
+	std::vector<SweepPreset> presets;
+	if (!LoadSweepPresets(iniFile, presets) || presets.empty()) {
+		printf("No presets in '%s'\n", iniFile);
+		exit(1);
+	}
+	if (numThreads < 1) {
+		numThreads = std::max(1, (int)std::thread::hardware_concurrency());
+	}
+
+	std::vector<int> order;
+	for (int i=0;i<presets.size();i++) {
+		order.push_back(i);
+		presets[i].f = fopen(presets[i].dbFile.c_str(), "w");
+		presets[i].numBytes = 0;
+		if (presets[i].f == NULL) {
+			perror("Unable to open output file");
+			exit(1);
+		}
+	}
+	std::stable_sort(order.begin(), order.end(), [&presets](int a, int b) {
+		return SweepOrderLess(presets[a].config, presets[b].config);
+	});
+
+	Timer timer;
+	double tStart = timer.GetTime();
+	std::atomic<int> nextFrame(0);
+	SweepWriter writer(&presets, 4 * numThreads);
+	std::vector<Trace *> tracers;
+	std::vector<SweepStats> stats(numThreads);
+	std::vector<std::thread> threads;
+	for (int i=0;i<numThreads;i++) {
+		stats[i].numSegments.resize(presets.size(), 0);
+		stats[i].numStrips.resize(presets.size(), 0);
+		stats[i].numScans.resize(presets.size(), 0);
+		stats[i].tTrace.resize(presets.size(), 0.0);
+		stats[i].tDecode = 0.0;
+		tracers.push_back(new Trace());
+	}
+	for (int i=0;i<numThreads;i++) {
+		threads.push_back(std::thread(SweepThread, tracers[i], &presets, &order, &pngFiles, &nextFrame, &writer, &stats[i]));
+	}
+	for (int i=0;i<numThreads;i++) {
+		threads[i].join();
+		delete tracers[i];
+	}
+	double tTotal = timer.GetTime() - tStart;
+
+	double tDecode = 0.0;
+	for (int i=0;i<numThreads;i++) {
+		tDecode += stats[i].tDecode;
+	}
+	std::vector<int> &failed = writer.Failed();
+	std::sort(failed.begin(), failed.end());
+	for (int i=0;i<failed.size();i++) {
+		printf("Frame %d failed: %s\n", failed[i], pngFiles[failed[i]]);
+	}
+	printf("Frames: %d, failed: %d, presets: %d, threads: %d, decode: %f sec, total: %f sec\n",
+		(int)pngFiles.size(), (int)failed.size(), (int)presets.size(), numThreads, tDecode, tTotal);
+	printf("%-20s %-24s %8s %8s %6s %10s %10s\n", "preset", "file", "segments", "strips", "scans", "bytes", "trace (s)");
+	for (int i=0;i<presets.size();i++) {
+		SweepPreset &preset = presets[i];
+		fclose(preset.f);
+
+		int numSegments = 0, numStrips = 0, numScans = 0;
+		double tTrace = 0.0;
+		for (int j=0;j<numThreads;j++) {
+			numSegments += stats[j].numSegments[i];
+			numStrips += stats[j].numStrips[i];
+			numScans += stats[j].numScans[i];
+			tTrace += stats[j].tTrace[i];
+		}
+		printf("%-20s %-24s %8d %8d %6d %10d %10.3f\n", preset.name.c_str(), preset.dbFile.c_str(),
+			numSegments, numStrips, numScans, (int)preset.numBytes, tTrace);
+	}
+	if (!failed.empty()) {
+		exit(1);
+	}
+}
+
+//
+// Large image in tiles, strips are written with image sized coordinates (see TiledTrace::WriteStrips)
+//
+static void RunTiledTrace(int numThreads, int tileSize, char *outFile, std::vector<char *> &args) {
+	if (args.empty()) {
+		printf("No input image\n");
+		exit(1);
+	}
+	if (numThreads < 1) {
+		numThreads = std::max(1, (int)std::thread::hardware_concurrency());
+	}
+	Logger::Initialize();
+	Logger::AddSink(Logger::CreateSink("LogConsoleSink"), "console", 0, NULL);
+	Logger::SetAllSinkDebugLevel(Logger::kMCInfo);
+
+	Timer timer;
+	double tStart = timer.GetTime();
+	Bitmap *bitmap = NULL;
+	TileSource *source = NULL;
+	std::string inFile(args[0]);
+	if ((inFile.length() > 4) && (inFile.compare(inFile.length() - 4, 4, ".png") == 0)) {
+		bitmap = Bitmap::LoadPNGImage(inFile);
+		if (bitmap == NULL) {
+			printf("Unable to load '%s'\n", args[0]);
+			exit(1);
+		}
+		source = new BitmapTileSource(bitmap);
+	} else {
+		if (args.size() < 3) {
+			printf("Raw input needs <width> <height> [<bytes per pixel>]\n");
+			exit(1);
+		}
+		RawTileSource *raw = new RawTileSource();
+		if (!raw->Open(inFile, atoi(args[1]), atoi(args[2]), (args.size() > 3) ? atoi(args[3]) : 4)) {
+			printf("Unable to open '%s'\n", args[0]);
+			exit(1);
+		}
+		source = raw;
+	}
+	double tLoad = timer.GetTime() - tStart;
+
+	Trace tracer;
+	TiledTrace tiled(source, tracer.GetConfig(), tileSize);
+	tStart = timer.GetTime();
+	if (!tiled.Run(numThreads)) {
+		exit(1);
+	}
+	double tTrace = timer.GetTime() - tStart;
+	if (!TiledTrace::WriteStrips(std::string(outFile), tiled.Strips())) {
+		perror("Unable to write output file");
+		exit(1);
+	}
+	printf("%dx%d, tiles: %d, threads: %d, load: %f sec, trace: %f sec, segments: %d, welded: %d, strips: %d\n",
+		source->Width(), source->Height(), tiled.NumTiles(), numThreads, tLoad, tTrace, tiled.NumSegments(),
+		tiled.NumWelded(), (int)tiled.Strips().size());
+	delete source;
+	if (bitmap != NULL) {
+		delete bitmap;
+	}
+}
+
+//
+// Traces a stream of raw frames, e.g. straight from ffmpeg. Frames are traced as they arrive
+// and each frame is appended to the .db file, nothing is decoded from or written to disk.
+// Grey and Y4M frames go straight to the luma plane, see Trace::SetGreyFrame.
+//
+static void RunVideoTrace(char *dbFile, std::vector<char *> &args) {
+	if (args.empty()) {
+		printf("No input stream\n");
+		exit(1);
+	}
+	VideoFormat format = kVideoFormat_Y4M;
+	if ((args.size() > 1) && !ParseVideoFormat(args[1], &format)) {
+		printf("Unknown frame format '%s', use y4m, grey or rgba\n", args[1]);
+		exit(1);
+	}
+	if ((format != kVideoFormat_Y4M) && (args.size() < 4)) {
+		printf("Raw frames need <width> <height>\n");
+		exit(1);
+	}
+	VideoReader reader;
+	int width = (args.size() > 3) ? atoi(args[2]) : 0;
+	int height = (args.size() > 3) ? atoi(args[3]) : 0;
+	if (!reader.Open(std::string(args[0]), format, width, height)) {
+		printf("Unable to open '%s'\n", args[0]);
+		exit(1);
+	}
+	FILE *f = fopen(dbFile, "w");
+	if (f == NULL) {
+		perror("Unable to open output file");
+		exit(1);
+	}
+
+	Timer timer;
+	Trace tracer;
+	std::string data;
+	double tRead = 0.0;
+	double tTrace = 0.0;
+	double tStart = timer.GetTime();
+	while(reader.ReadFrame()) {
+		double tFrame = timer.GetTime();
+		tRead += tFrame - tStart;
+		if (reader.BytesPerPixel() == 1) {
+			tracer.SetGreyFrame(reader.Buffer(), reader.Width(), reader.Height());
+		} else {
+			tracer.SetFrame(reader.Buffer(), reader.Width(), reader.Height());
+		}
+		tracer.Update();
+		data.clear();
+		Trace::SerializeStrips(data, tracer.OptimizedStrips());
+		fwrite(data.c_str(), 1, data.length(), f);
+		tStart = timer.GetTime();
+		tTrace += tStart - tFrame;
+	}
+	fclose(f);
+	int numFrames = reader.NumFrames();
+	printf("Frames: %d, %dx%d, read: %f sec, trace: %f sec, %.1f frames/sec\n", numFrames, reader.Width(),
+		reader.Height(), tRead, tTrace, (numFrames > 0) ? numFrames / (tRead + tTrace) : 0.0);
+}
+
+//
+// Renders every frame of a .db to one reused buffer and streams it, e.g. to ffmpeg. Strip
+// coordinates are 8-bit so the default frame is 256x256, lines are drawn as the Go renderer does.
+//
+static void RunVideoExport(char *dbFile, std::vector<char *> &args) {
+	if (args.empty()) {
+		printf("No output stream\n");
+		exit(1);
+	}
+	VideoFormat format = kVideoFormat_Y4M;
+	if ((args.size() > 1) && !ParseVideoFormat(args[1], &format)) {
+		printf("Unknown frame format '%s', use y4m, grey or rgba\n", args[1]);
+		exit(1);
+	}
+	int width = (args.size() > 3) ? atoi(args[2]) : 256;
+	int height = (args.size() > 3) ? atoi(args[3]) : 256;
+	int fps = (args.size() > 4) ? atoi(args[4]) : 30;
+
+	VideoWriter writer;
+	if (!writer.Open(std::string(args[0]), format, width, height, fps)) {
+		printf("Unable to open '%s'\n", args[0]);
+		exit(1);
+	}
+	// stdout may be the video, everything printed goes to stderr
+	dup2(2, 1);
+
+	Animation animation;
+	animation.LoadFromFile(dbFile);
+	if (animation.Frames() == 0) {
+		printf("No frames in '%s'\n", dbFile);
+		exit(1);
+	}
+
+	Timer timer;
+	std::vector<unsigned char> buffer(width * height * writer.BytesPerPixel());
+	double tRender = 0.0;
+	double tWrite = 0.0;
+	for (int i=0;i<animation.Frames();i++) {
+		double tStart = timer.GetTime();
+		animation.At(i)->Rasterize(buffer.data(), width, height, writer.BytesPerPixel());
+		double tFrame = timer.GetTime();
+		tRender += tFrame - tStart;
+		if (!writer.WriteFrame(buffer.data())) {
+			break;
+		}
+		tWrite += timer.GetTime() - tFrame;
+	}
+	writer.Close();
+	printf("Frames: %d of %d, %dx%d, render: %f sec, write: %f sec\n", writer.NumFrames(), animation.Frames(),
+		width, height, tRender, tWrite);
+	animation.Clear();
+}
 
 int main(int argc, char **argv) {
 	// TODO: ARGS!
 	int mode = GEN_MODE;
 
 	char *filename = NULL;
+	int numWorkers = 0;
+	int tileSize = 512;
+	char *eventLogFile = NULL;
+	std::vector<char *> frameFiles;
 
 	if (argc > 1) {
 		for (int i=1;i<argc;i++) {
-			if (argv[i][0] == '-') {
+			// A lone '-' is stdin, not an option
+			if ((argv[i][0] == '-') && (argv[i][1] != '\0')) {
 				switch(argv[i][1]) {
 					case 'r' :
 						mode = UI_MODE;
 						break;
+					case 'w' :
+						mode = WORKER_MODE;
+						break;
+					case 'b' :
+						mode = BENCH_MODE;
+						break;
+					case 'l' :
+						// Structured trace diagnostics, decode with 'logdecode'
+						if ((i + 1) < argc) {
+							eventLogFile = argv[++i];
+						}
+						break;
+					case 'p' :
+						mode = POOL_MODE;
+						if ((i + 1) < argc) {
+							numWorkers = atoi(argv[++i]);
+						}
+						break;
+					case 's' :
+						// Thread count, 0 uses one per core
+						mode = SWEEP_MODE;
+						if ((i + 1) < argc) {
+							numWorkers = atoi(argv[++i]);
+						}
+						break;
+					case 't' :
+						// Thread count (0 uses one per core) and tile size in pixels
+						mode = TILE_MODE;
+						if ((i + 2) < argc) {
+							numWorkers = atoi(argv[++i]);
+							tileSize = atoi(argv[++i]);
+						}
+						break;
+					case 'v' :
+						mode = VIDEO_MODE;
+						break;
+					case 'x' :
+						mode = EXPORT_MODE;
+						break;
 					default:
 						printf("ERROR: Unknown arg '%s'\n", argv[i]);
 						exit(1);
 				}
-			} else {
+			} else if (filename == NULL) {
 				filename = argv[i];
+			} else {
+				frameFiles.push_back(argv[i]);
 			}
 		}
-		if (filename == NULL) {
-			printf("Usage: player [-r] <db file>\n");
+		if ((filename == NULL) && (mode != WORKER_MODE) && (mode != BENCH_MODE)) {
+			printf("Usage: player [-r] [-l <event log>] <db file>\n");
+			printf("       player -p <workers> <db file> <png files...>\n");
+			printf("       player -s <threads> <preset ini> <png files...>\n");
+			printf("       player -t <threads> <tile size> <out file> <png or raw file> [<width> <height> [<bytes per pixel>]]\n");
+			printf("       player -v <db file> <stream or '-'> [y4m | grey <width> <height> | rgba <width> <height>]\n");
+			printf("       player -x <db file> <stream or '-'> [y4m | grey | rgba] [<width> <height> [<fps>]]\n");
+			printf("       player -b (benchmarks)\n");
 		}
 	} else {
-		printf("Usage: player [-r] <db file>\n");
+		printf("Usage: player [-r] [-l <event log>] <db file>\n");
+		printf("       player -p <workers> <db file> <png files...>\n");
+		printf("       player -s <threads> <preset ini> <png files...>\n");
+		printf("       player -t <threads> <tile size> <out file> <png or raw file> [<width> <height> [<bytes per pixel>]]\n");
+		printf("       player -v <db file> <stream or '-'> [y4m | grey <width> <height> | rgba <width> <height>]\n");
+		printf("       player -x <db file> <stream or '-'> [y4m | grey | rgba] [<width> <height> [<fps>]]\n");
+		printf("       player -b (benchmarks)\n");
 		exit(1);
 	}
 
+	if (mode == WORKER_MODE) {
+		RunTraceWorker();
+		exit(0);
+	}
+
+	if (mode == BENCH_MODE) {
+		RunBenchmarks();
+		exit(0);
+	}
+
+	if (mode == POOL_MODE) {
+		RunTracePool(argv[0], numWorkers, filename, frameFiles);
+		exit(0);
+	}
+
+	if (mode == SWEEP_MODE) {
+		RunTraceSweep(numWorkers, filename, frameFiles);
+		exit(0);
+	}
+
+	if (mode == TILE_MODE) {
+		RunTiledTrace(numWorkers, tileSize, filename, frameFiles);
+		exit(0);
+	}
+
+	if (mode == VIDEO_MODE) {
+		RunVideoTrace(filename, frameFiles);
+		exit(0);
+	}
+
+	if (mode == EXPORT_MODE) {
+		RunVideoExport(filename, frameFiles);
+		exit(0);
+	}
+
 	// Generate file
 	if (mode == GEN_MODE) {
+		Logger::Initialize();
+		Logger::AddSink(Logger::CreateSink("LogConsoleSink"), "console", 0, NULL);
+		Logger::SetAllSinkDebugLevel(Logger::kMCInfo);
+		if (eventLogFile != NULL) {
+			LogBinaryFileSink *eventSink = new LogBinaryFileSink();
+			if (eventSink->Open(eventLogFile)) {
+				Logger::AddRecordSink(eventSink);
+			}
+		}
+
 		Bitmap *bitmap = Bitmap::LoadPNGImage(std::string(filename));
 		Trace tracer;
 		tracer.ProcessImage(bitmap->Buffer(), bitmap->Width(), bitmap->Height());
@@ -170,6 +1271,7 @@ int main(int argc, char **argv) {
 
 
 	animController.LoadData(filename);
+	generateController.Attach(&animController, &imageController);
 	UIRenderView uiRenderView(&animController);
 	UIGenerateView uiGenerateView(&generateController);
 	UIImageView uiImageView(&imageController);
@@ -197,6 +1299,7 @@ int main(int argc, char **argv) {
 	window.CloseWindow();
 	ui.Close();
 	glfwTerminate();
+	Logger::DisableAsync();
 	return 0;
 }
 
@@ -216,7 +1319,8 @@ void Initialize() {
 		Logger::AddSink(Logger::CreateSink("LogConsoleSink"), "console", 0, NULL);
 	}
 	Logger::SetAllSinkDebugLevel(logLevel);	
-
+	// The UI traces on a worker thread, keep logging off the hot paths
+	Logger::EnableAsync(4096);
 }
 
 
@@ -0,0 +1,418 @@
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <algorithm>
+#include <thread>
+
+#include "tiletrace.h"
+#include "logger.h"
+
+using namespace gnilk;
+using namespace gnilk::contour;
+
+//
+// BitmapTileSource
+//
+BitmapTileSource::BitmapTileSource(Bitmap *bitmap) {
+	this->bitmap = bitmap;
+}
+
+bool BitmapTileSource::ReadRect(unsigned char *dst, int x, int y, int w, int h) {
+	for (int row=0;row<h;row++) {
+		memcpy(&dst[row * w * 4], bitmap->Buffer(x, y + row), w * 4);
+	}
+	return true;
+}
+
+//
+// RawTileSource
+//
+RawTileSource::RawTileSource() {
+	this->fd = -1;
+	this->width = 0;
+	this->height = 0;
+	this->bytesPerPixel = 4;
+}
+
+RawTileSource::~RawTileSource() {
+	if (fd >= 0) {
+		close(fd);
+	}
+}
+
+bool RawTileSource::Open(const std::string &filename, int width, int height, int bytesPerPixel) {
+	if ((bytesPerPixel != 1) && (bytesPerPixel != 4)) {
+		CACHED_LOGGER("TiledTrace")->Error("Raw input must be 1 (grey) or 4 (RGBA) bytes per pixel, got %d", bytesPerPixel);
+		return false;
+	}
+	fd = open(filename.c_str(), O_RDONLY);
+	if (fd < 0) {
+		CACHED_LOGGER("TiledTrace")->Error("Unable to open '%s'", filename.c_str());
+		return false;
+	}
+	off_t expected = (off_t)width * height * bytesPerPixel;
+	if (lseek(fd, 0, SEEK_END) < expected) {
+		CACHED_LOGGER("TiledTrace")->Error("'%s' is smaller than %dx%d at %d bytes per pixel", filename.c_str(), width, height, bytesPerPixel);
+		close(fd);
+		fd = -1;
+		return false;
+	}
+	this->width = width;
+	this->height = height;
+	this->bytesPerPixel = bytesPerPixel;
+	return true;
+}
+
+// pread keeps no file position, so tiles can be read from several threads
+bool RawTileSource::ReadRect(unsigned char *dst, int x, int y, int w, int h) {
+	std::vector<unsigned char> grey;
+	if (bytesPerPixel == 1) {
+		grey.resize(w);
+	}
+	for (int row=0;row<h;row++) {
+		off_t offset = ((off_t)(y + row) * width + x) * bytesPerPixel;
+		unsigned char *out = &dst[row * w * 4];
+		unsigned char *in = (bytesPerPixel == 1) ? grey.data() : out;
+		size_t numBytes = (size_t)w * bytesPerPixel;
+		if (pread(fd, in, numBytes, offset) != (ssize_t)numBytes) {
+			return false;
+		}
+		if (bytesPerPixel == 1) {
+			for (int i=0;i<w;i++) {
+				out[i*4+0] = out[i*4+1] = out[i*4+2] = grey[i];
+				out[i*4+3] = 255;
+			}
+		}
+	}
+	return true;
+}
+
+//
+// TiledTrace
+//
+TiledTrace::TiledTrace(TileSource *source, const Config &config, int tileSize) {
+	this->source = source;
+	this->config = config;
+	// Whole blocks per tile, so a block never straddles a seam
+	int bs = std::max(config.BlockSize, 1);
+	this->tileSize = std::max(((tileSize + bs - 1) / bs) * bs, 4 * bs);
+	this->overlap = bs;
+	this->tilesX = (source->Width() + this->tileSize - 1) / this->tileSize;
+	this->tilesY = (source->Height() + this->tileSize - 1) / this->tileSize;
+	this->numSegments = 0;
+	this->numWelded = 0;
+}
+
+TiledTrace::~TiledTrace() {
+	for (int i=0;i<strips.size();i++) {
+		delete strips[i];
+	}
+}
+
+bool TiledTrace::Run(int numThreads) {
+	if (numThreads < 1) {
+		numThreads = std::max(1, (int)std::thread::hardware_concurrency());
+	}
+	tileSegments.clear();
+	tileSegments.resize(NumTiles());
+
+	std::atomic<int> nextTile(0);
+	std::atomic<bool> failed(false);
+	std::vector<std::thread> threads;
+	for (int i=0;i<numThreads;i++) {
+		threads.push_back(std::thread(&TiledTrace::TraceThread, this, &nextTile, &failed));
+	}
+	for (int i=0;i<numThreads;i++) {
+		threads[i].join();
+	}
+	if (failed) {
+		return false;
+	}
+
+	// Tile order, the result doesn't depend on which thread traced what
+	std::vector<Segment> segments;
+	for (int i=0;i<tileSegments.size();i++) {
+		segments.insert(segments.end(), tileSegments[i].begin(), tileSegments[i].end());
+		std::vector<Segment>().swap(tileSegments[i]);
+	}
+	WeldSeams(segments);
+	numSegments = segments.size();
+	BuildStrips(segments);
+
+	CACHED_LOGGER("TiledTrace")->Info("%dx%d, %d tiles of %d, segments: %d, welded seam ends: %d, strips: %d",
+		source->Width(), source->Height(), NumTiles(), tileSize, numSegments, numWelded, (int)strips.size());
+	return true;
+}
+
+// One trace session and tile buffer per thread, tiles are taken in order
+void TiledTrace::TraceThread(std::atomic<int> *nextTile, std::atomic<bool> *failed) {
+	Trace tracer;
+	tracer.SetConfig(config);
+	std::vector<unsigned char> buffer;
+	int idxTile;
+	while(!(*failed) && ((idxTile = (*nextTile)++) < NumTiles())) {
+		if (!TraceTile(tracer, idxTile, buffer)) {
+			*failed = true;
+		}
+	}
+}
+
+//
+// Liang-Barsky, clips a-b to the rectangle - returns false if nothing is left
+//
+static bool ClipSegment(float &ax, float &ay, float &bx, float &by, float xmin, float ymin, float xmax, float ymax) {
+	float dx = bx - ax;
+	float dy = by - ay;
+	float p[4] = { -dx, dx, -dy, dy };
+	float q[4] = { ax - xmin, xmax - ax, ay - ymin, ymax - ay };
+	float t0 = 0.0f;
+	float t1 = 1.0f;
+	for (int i=0;i<4;i++) {
+		if (p[i] == 0.0f) {
+			if (q[i] < 0.0f) {
+				return false;
+			}
+			continue;
+		}
+		float t = q[i] / p[i];
+		if (p[i] < 0.0f) {
+			t0 = std::max(t0, t);
+		} else {
+			t1 = std::min(t1, t);
+		}
+		if (t0 > t1) {
+			return false;
+		}
+	}
+	bx = ax + t1 * dx;
+	by = ay + t1 * dy;
+	ax = ax + t0 * dx;
+	ay = ay + t0 * dy;
+	return true;
+}
+
+bool TiledTrace::TraceTile(Trace &tracer, int idxTile, std::vector<unsigned char> &buffer) {
+	int width = source->Width();
+	int height = source->Height();
+	// Tile proper, the segments are clipped to this
+	int cx0 = (idxTile % tilesX) * tileSize;
+	int cy0 = (idxTile / tilesX) * tileSize;
+	int cx1 = std::min(width, cx0 + tileSize);
+	int cy1 = std::min(height, cy0 + tileSize);
+	// Traced area, one block of overlap so contours crossing the seam are seen by both tiles
+	int x0 = std::max(0, cx0 - overlap);
+	int y0 = std::max(0, cy0 - overlap);
+	int x1 = std::min(width, cx1 + overlap);
+	int y1 = std::min(height, cy1 + overlap);
+	int w = x1 - x0;
+	int h = y1 - y0;
+
+	buffer.resize((size_t)w * h * 4);
+	if (!source->ReadRect(buffer.data(), x0, y0, w, h)) {
+		CACHED_LOGGER("TiledTrace")->Error("Tile %d, reading %dx%d at %d,%d failed", idxTile, w, h, x0, y0);
+		return false;
+	}
+	tracer.SetImage(buffer.data(), w, h);
+	tracer.Update();
+
+	std::vector<Segment> &out = tileSegments[idxTile];
+	std::vector<LineSegment *> &lineSegments = tracer.OptimizedSegments();
+	for (int i=0;i<lineSegments.size();i++) {
+		float ax = (float)(lineSegments[i]->Start().X() + x0);
+		float ay = (float)(lineSegments[i]->Start().Y() + y0);
+		float bx = (float)(lineSegments[i]->End().X() + x0);
+		float by = (float)(lineSegments[i]->End().Y() + y0);
+		if (!ClipSegment(ax, ay, bx, by, (float)cx0, (float)cy0, (float)cx1, (float)cy1)) {
+			continue;
+		}
+		Segment segment;
+		segment.a = Point((int)lroundf(ax), (int)lroundf(ay));
+		segment.b = Point((int)lroundf(bx), (int)lroundf(by));
+		if (!segment.a.IsEqual(segment.b)) {
+			out.push_back(segment);
+		}
+	}
+	return true;
+}
+
+//
+// Ends on a seam line come from clipping on both sides of it. Ends on the same seam closer than
+// ClusterCutOffDistance (along the seam) are moved to their mean, so the two halves of a contour
+// share an end point and are joined to one strip.
+//
+void TiledTrace::WeldSeams(std::vector<Segment> &segments) {
+	int maxGap = std::max(1, (int)config.ClusterCutOffDistance);
+	numWelded = 0;
+	for (int axis=0;axis<2;axis++) {
+		// seam position, position along the seam, end index (segment * 2 + 0/1)
+		std::vector<std::pair<std::pair<int, int>, int> > ends;
+		int limit = (axis == 0) ? source->Width() : source->Height();
+		for (int i=0;i<segments.size();i++) {
+			Point *pts[2] = { &segments[i].a, &segments[i].b };
+			for (int e=0;e<2;e++) {
+				int across = (axis == 0) ? pts[e]->x : pts[e]->y;
+				int along = (axis == 0) ? pts[e]->y : pts[e]->x;
+				if ((across > 0) && (across < limit) && ((across % tileSize) == 0)) {
+					ends.push_back(std::make_pair(std::make_pair(across, along), i * 2 + e));
+				}
+			}
+		}
+		std::sort(ends.begin(), ends.end());
+
+		int first = 0;
+		while (first < ends.size()) {
+			int last = first;
+			int sum = ends[first].first.second;
+			while (((last + 1) < ends.size()) && (ends[last + 1].first.first == ends[first].first.first) &&
+				   ((ends[last + 1].first.second - ends[last].first.second) <= maxGap)) {
+				last++;
+				sum += ends[last].first.second;
+			}
+			if (last > first) {
+				int along = (int)lroundf((float)sum / (float)(last - first + 1));
+				for (int i=first;i<=last;i++) {
+					Segment &segment = segments[ends[i].second / 2];
+					Point &pt = (ends[i].second & 1) ? segment.b : segment.a;
+					if (axis == 0) {
+						pt.y = along;
+					} else {
+						pt.x = along;
+					}
+				}
+				numWelded += last - first;
+			}
+			first = last + 1;
+		}
+	}
+
+	// Welding can collapse a segment, and a segment on a seam line is seen by both tiles
+	std::vector<std::pair<std::pair<int64_t, int64_t>, int> > keys;
+	for (int i=0;i<segments.size();i++) {
+		int64_t ka = ((int64_t)segments[i].a.y << 32) | (uint32_t)segments[i].a.x;
+		int64_t kb = ((int64_t)segments[i].b.y << 32) | (uint32_t)segments[i].b.x;
+		keys.push_back(std::make_pair(std::make_pair(std::min(ka, kb), std::max(ka, kb)), i));
+	}
+	std::sort(keys.begin(), keys.end());
+	std::vector<uint8_t> keep(segments.size(), 1);
+	for (int i=0;i<keys.size();i++) {
+		int idx = keys[i].second;
+		if (segments[idx].a.IsEqual(segments[idx].b) || ((i > 0) && (keys[i].first == keys[i-1].first))) {
+			keep[idx] = 0;
+		}
+	}
+	int numKept = 0;
+	for (int i=0;i<segments.size();i++) {
+		if (keep[i]) {
+			segments[numKept++] = segments[i];
+		}
+	}
+	segments.resize(numKept);
+}
+
+//
+// Joins segments sharing end points, open chains are walked from an end first then what is
+// left (closed loops). Chains stop at junctions, where more than two segments meet.
+//
+void TiledTrace::BuildStrips(std::vector<Segment> &segments) {
+	int n = segments.size();
+	// end point -> end index (segment * 2 + 0/1), ends at the same point are adjacent after sorting
+	std::vector<std::pair<int64_t, int> > ends;
+	ends.reserve(n * 2);
+	for (int i=0;i<n;i++) {
+		ends.push_back(std::make_pair(((int64_t)segments[i].a.y << 32) | (uint32_t)segments[i].a.x, i * 2 + 0));
+		ends.push_back(std::make_pair(((int64_t)segments[i].b.y << 32) | (uint32_t)segments[i].b.x, i * 2 + 1));
+	}
+	std::sort(ends.begin(), ends.end());
+	// first entry in 'ends' and number of ends, for the point of each end
+	std::vector<int> groupStart(n * 2);
+	std::vector<int> groupSize(n * 2);
+	for (int i=0;i<ends.size();) {
+		int j = i;
+		while ((j < ends.size()) && (ends[j].first == ends[i].first)) {
+			j++;
+		}
+		for (int k=i;k<j;k++) {
+			groupStart[ends[k].second] = i;
+			groupSize[ends[k].second] = j - i;
+		}
+		i = j;
+	}
+
+	std::vector<uint8_t> used(n, 0);
+	for (int pass=0;pass<2;pass++) {
+		for (int i=0;i<n;i++) {
+			if (used[i]) {
+				continue;
+			}
+			int end = 0;
+			if (pass == 0) {
+				// open chains only, start from the end that isn't a plain continuation
+				if (groupSize[i * 2 + 0] != 2) {
+					end = 0;
+				} else if (groupSize[i * 2 + 1] != 2) {
+					end = 1;
+				} else {
+					continue;
+				}
+			}
+			Strip *strip = new Strip();
+			int seg = i;
+			while (true) {
+				used[seg] = 1;
+				Segment &segment = segments[seg];
+				if (strip->empty()) {
+					strip->push_back((end == 0) ? segment.a : segment.b);
+				}
+				strip->push_back((end == 0) ? segment.b : segment.a);
+				// continue through the far end if exactly one other segment starts there
+				int far = seg * 2 + (end ^ 1);
+				if (groupSize[far] != 2) {
+					break;
+				}
+				int other = ends[groupStart[far]].second;
+				if (other == far) {
+					other = ends[groupStart[far] + 1].second;
+				}
+				if (used[other / 2]) {
+					break;
+				}
+				seg = other / 2;
+				end = other & 1;
+			}
+			strips.push_back(strip);
+		}
+	}
+}
+
+static void WriteUInt32(std::string &out, uint32_t value) {
+	for (int i=0;i<4;i++) {
+		out.push_back((char)((value >> (i * 8)) & 0xff));
+	}
+}
+
+void TiledTrace::SerializeStrips(std::string &out, std::vector<Strip *> &strips) {
+	WriteUInt32(out, strips.size());
+	for (int i=0;i<strips.size();i++) {
+		Strip *strip = strips[i];
+		WriteUInt32(out, strip->size());
+		for (int j=0;j<strip->size();j++) {
+			WriteUInt32(out, (uint32_t)strip->at(j).x);
+			WriteUInt32(out, (uint32_t)strip->at(j).y);
+		}
+	}
+}
+
+bool TiledTrace::WriteStrips(const std::string &filename, std::vector<Strip *> &strips) {
+	FILE *f = fopen(filename.c_str(), "wb");
+	if (f == NULL) {
+		CACHED_LOGGER("TiledTrace")->Error("Unable to open '%s' for writing", filename.c_str());
+		return false;
+	}
+	std::string data;
+	SerializeStrips(data, strips);
+	bool ok = (fwrite(data.data(), 1, data.length(), f) == data.length());
+	fclose(f);
+	return ok;
+}
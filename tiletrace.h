@@ -0,0 +1,100 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <atomic>
+
+#include "bitmap.h"
+#include "contour.h"
+
+namespace gnilk {
+	namespace contour {
+
+		//
+		// Pixel source for tiled tracing, ReadRect is called from several threads at once
+		//
+		class TileSource {
+		public:
+			virtual ~TileSource() {}
+			virtual int Width() = 0;
+			virtual int Height() = 0;
+			// w x h RGBA pixels at x,y to 'dst', rows are packed
+			virtual bool ReadRect(unsigned char *dst, int x, int y, int w, int h) = 0;
+		};
+
+		// Decoded image, picopng/lodepng have no row access so a PNG is always fully in memory
+		class BitmapTileSource : public TileSource {
+		private:
+			Bitmap *bitmap;
+		public:
+			BitmapTileSource(Bitmap *bitmap);
+			virtual int Width() { return bitmap->Width(); }
+			virtual int Height() { return bitmap->Height(); }
+			virtual bool ReadRect(unsigned char *dst, int x, int y, int w, int h);
+		};
+
+		//
+		// Headerless RGBA (4 bytes per pixel) or grey (1 byte) file, rows are read when a tile
+		// needs them so only the tiles in flight are in memory
+		//
+		class RawTileSource : public TileSource {
+		private:
+			int fd;
+			int width;
+			int height;
+			int bytesPerPixel;
+		public:
+			RawTileSource();
+			virtual ~RawTileSource();
+			bool Open(const std::string &filename, int width, int height, int bytesPerPixel);
+			virtual int Width() { return width; }
+			virtual int Height() { return height; }
+			virtual bool ReadRect(unsigned char *dst, int x, int y, int w, int h);
+		};
+
+		//
+		// Traces an image of any size as tiles. Each tile is read with one block of overlap and
+		// traced by its own session, the segments are clipped to the tile and translated to image
+		// coordinates. Segment ends on a seam are welded to the matching end from the other side
+		// and connected segments are joined to strips. Peak memory is one tile per thread plus
+		// the segments.
+		//
+		class TiledTrace {
+		public:
+			TiledTrace(TileSource *source, const Config &config, int tileSize);
+			virtual ~TiledTrace();
+
+			bool Run(int numThreads);
+			int NumTiles() { return tilesX * tilesY; }
+			int NumSegments() { return numSegments; }
+			int NumWelded() { return numWelded; }
+			std::vector<Strip *> &Strips() { return strips; }
+
+			// Image sized coordinates don't fit the 8-bit .db format, strips are stored as
+			// uint32 count, per strip uint32 count followed by int32 x,y - all little endian
+			static void SerializeStrips(std::string &out, std::vector<Strip *> &strips);
+			static bool WriteStrips(const std::string &filename, std::vector<Strip *> &strips);
+		private:
+			struct Segment {
+				Point a;
+				Point b;
+			};
+			void TraceThread(std::atomic<int> *nextTile, std::atomic<bool> *failed);
+			bool TraceTile(Trace &tracer, int idxTile, std::vector<unsigned char> &buffer);
+			void WeldSeams(std::vector<Segment> &segments);
+			void BuildStrips(std::vector<Segment> &segments);
+		private:
+			TileSource *source;
+			Config config;
+			int tileSize;
+			int overlap;
+			int tilesX;
+			int tilesY;
+			int numSegments;
+			int numWelded;
+			std::vector<std::vector<Segment> > tileSegments;	// per tile, image coordinates
+			std::vector<Strip *> strips;
+		};
+	}
+}
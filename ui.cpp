@@ -315,9 +315,24 @@ void UIGenerateView::Render() {
     MakeFloatSlider("ccd", &controller->ccd,0.0,255.0, "Cluster Cutoff Distance\nBreak condition for new cluster");
     MakeFloatSlider("oca", &controller->oca,0.0,1.0, "Optimization Cutoff Angle\nBreak condition when merging line segments to strips");
 
+    ImGui::Checkbox("In-process", &controller->inProcess);
+    if (controller->inProcess) {
+        ImGui::SameLine();
+        ImGui::Checkbox("Live update", &controller->liveUpdate);
+    }
+
     if (ImGui::Button("Generate")) {
         this->controller->GenerateData();
     }
+    if (controller->IsBusy()) {
+        ImGui::SameLine();
+        ImGui::Text("Tracing...");
+    } else if (controller->inProcess) {
+        ImGui::SameLine();
+        ImGui::Text("Last trace: %.1f ms", controller->LastTraceTime() * 1000.0);
+    }
+    // Hand over finished in-process traces, kick off live updates
+    this->controller->Update();
     ImGui::End();
 }
 
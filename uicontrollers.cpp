@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <string>
+#include <algorithm>
 
 #include <GLFW/glfw3.h>
 #include <OpenGL/glu.h>
@@ -9,6 +10,8 @@
 #include "animation.h"
 #include "uicontrollers.h"
 #include "inifile.h"
+#include "contour.h"
+#include "timer.h"
 
 using namespace gnilk;
 
@@ -20,6 +23,53 @@ void AnimController::LoadData(char *filename) {
 	ReloadData();
 }
 
+//
+// Replace the animation with a single frame traced in-process. The segments are in 'width' x 'height'
+// image coordinates, like './contour' (Rescale, Width 255) they are rescaled to 255 wide with the height
+// from the aspect ratio before the strips are built. Portrait sources are fitted to 255 high instead.
+//
+void AnimController::LoadData(std::vector<contour::LineSegment *> &segments, int width, int height) {
+	int dstWidth = width;
+	int dstHeight = height;
+	if ((width > 0) && (height > 0)) {
+		if (width >= height) {
+			dstWidth = 255;
+			dstHeight = (int)(255.0 * ((double)height / (double)width));
+		} else {
+			dstWidth = (int)(255.0 * ((double)width / (double)height));
+			dstHeight = 255;
+		}
+	}
+	double xFactor = 1.0 / (double)std::max(width, 1);
+	double yFactor = 1.0 / (double)std::max(height, 1);
+	std::vector<contour::LineSegment *> scaled;
+	for (int i=0;i<segments.size();i++) {
+		auto ls = segments[i];
+		contour::Point start((int)(dstWidth * xFactor * ls->Start().X()), (int)(dstHeight * yFactor * ls->Start().Y()));
+		contour::Point end((int)(dstWidth * xFactor * ls->End().X()), (int)(dstHeight * yFactor * ls->End().Y()));
+		scaled.push_back(new contour::LineSegment(start, end));
+	}
+	std::vector<contour::Strip *> strips;
+	contour::Trace::LineSegmentsToStrips(strips, scaled);
+
+	Frame *frame = new Frame();
+	for (int i=0;i<strips.size();i++) {
+		Strip strip;
+		for (int j=0;j<strips[i]->size();j++) {
+			strip.AddPoint((uint8_t)strips[i]->at(j).X(), (uint8_t)strips[i]->at(j).Y());
+		}
+		frame->AddStrip(strip);
+		delete strips[i];
+	}
+	for (int i=0;i<scaled.size();i++) {
+		delete scaled[i];
+	}
+	animation.Clear();
+	animation.AddFrame(frame);
+	animRenderVars.idxFrame = 0;
+	animRenderVars.numStrips = animation.MaxStrips();
+}
+
 void AnimController::ReloadData() {
 	if (animFilename == NULL) {
 		return;
@@ -52,9 +102,40 @@ int AnimController::GetMaxPoints(int frameIndex, int stripIndex) {
 //
 // Generate controller, responsible for generation of data
 //
-GenerateController::GenerateController() {
+GenerateController::GenerateController() :
+	workerDone(false)
+{
+	animController = NULL;
+	imageController = NULL;
+	externalProcess = NULL;
+	source = NULL;
+	imgContour = NULL;
+	imgSegments = NULL;
+	pending = false;
+	inProcess = true;
+	liveUpdate = false;
+	tLastTrace = 0.0;
+	sourceFile = "tanks/icbm_2.png";
+	lastConfig = trace.GetConfig();
 	ResetParameters();
 }
+
+GenerateController::~GenerateController() {
+	if (worker.joinable()) {
+		worker.join();
+	}
+	if (externalProcess != NULL) {
+		delete externalProcess;	// joins
+	}
+	if (source != NULL) {
+		delete source;
+	}
+}
+
+void GenerateController::Attach(AnimController *animController, ImageController *imageController) {
+	this->animController = animController;
+	this->imageController = imageController;
+}
 void GenerateController::ResetParameters() {
 	this->gl = 64;	// set default values
 	this->bs = 16;
@@ -69,6 +150,19 @@ void GenerateController::ResetParameters() {
 }
 
 void GenerateController::ReadDefaultSettings() {
+	if (inProcess) {
+		// Same values as 'contour -defaults' (glbConfig in contour.go), both paths start from the same parameters
+		this->gl = 32;
+		this->bs = 8;
+		this->cnt = 4.0;
+		this->cns = 2.0;
+		this->lcd = 10.0;
+		this->lca = 0.5;
+		this->lld = 3.0;
+		this->ccd = 50.0;
+		this->oca = 0.95;
+		return;
+	}
 	ProcessReadDefaults defaultReader;
 	Process proc("./contour");
 	proc.AddArgument("-defaults");
@@ -83,7 +177,7 @@ void GenerateController::ParseSettings(std::string strSettings) {
 	// logger->Debug("'%s'", strSettings.c_str());
 
 	inifile::SectionContainer settings;
-	settings.FromBuffer(strSettings);
+	settings.FromBuffer(std::move(strSettings));
 
 
 	this->gl = std::stoi(settings.GetValue("defaults", "gl", "32"));
@@ -98,22 +192,134 @@ void GenerateController::ParseSettings(std::string strSettings) {
 }
 
 void GenerateController::GenerateData() {
+	if (inProcess) {
+		GenerateDataInProcess();
+	} else {
+		GenerateDataExternal();
+	}
+}
+
+void GenerateController::GenerateDataExternal() {
+	if (externalProcess != NULL) {
+		Logger::GetLogger("GenerateController")->Warning("Generate already running");
+		return;
+	}
 	printf("Generate New Data!\n");
 	// This works!
-	Process proc("./contour");
-	proc.AddArgument(GetArg("-m"));
-	proc.AddArgument(GetArg("-gl %d", this->gl));
-	proc.AddArgument(GetArg("-bs %d", this->bs));
-	proc.AddArgument(GetArg("-cnt %f", this->cnt));
-	proc.AddArgument(GetArg("-cns %f", this->cns));
-	proc.AddArgument(GetArg("-lcd %f", this->lcd));
-	proc.AddArgument(GetArg("-lca %f", this->lca));
-	proc.AddArgument(GetArg("-lld %f", this->lld));
-	proc.AddArgument(GetArg("-ccd %f", this->ccd));
-	proc.AddArgument(GetArg("-oca %f", this->oca));
-	proc.AddArgument("tanks/icbm_2.png");
-	proc.AddArgument("ui_strips_tmp.db");
-	proc.ExecuteAndWait();
+	Process *proc = new Process("./contour");
+	proc->AddArgument(GetArg("-m"));
+	proc->AddArgument(GetArg("-gl %d", this->gl));
+	proc->AddArgument(GetArg("-bs %d", this->bs));
+	proc->AddArgument(GetArg("-cnt %f", this->cnt));
+	proc->AddArgument(GetArg("-cns %f", this->cns));
+	proc->AddArgument(GetArg("-lcd %f", this->lcd));
+	proc->AddArgument(GetArg("-lca %f", this->lca));
+	proc->AddArgument(GetArg("-lld %f", this->lld));
+	proc->AddArgument(GetArg("-ccd %f", this->ccd));
+	proc->AddArgument(GetArg("-oca %f", this->oca));
+	proc->AddArgument("tanks/icbm_2.png");
+	proc->AddArgument("ui_strips_tmp.db");
+	// Don't block the UI thread, Update picks up the result
+	if (!proc->ExecuteAsync()) {
+		delete proc;
+		return;
+	}
+	externalProcess = proc;
+}
+
+//
+// In-process generation, the trace runs on a worker thread and the result is handed
+// over to the anim/image controllers from Update (called on the UI thread each frame).
+// The trace session keeps the decoded image and all stages, so tweaking a parameter
+// only re-runs the stages depending on it.
+//
+static contour::Config ConfigFromParameters(GenerateController *gen, contour::Config config) {
+	config.GreyThresholdLevel = (uint8_t)gen->gl;
+	config.BlockSize = gen->bs;
+	config.ContrastFactor = gen->cnt;
+	config.ContrastScale = gen->cns;
+	config.LineCutOffDistance = gen->lcd;
+	config.LineCutOffAngle = gen->lca;
+	config.LongLineDistance = gen->lld;
+	config.ClusterCutOffDistance = gen->ccd;
+	config.OptimizationCutOffAngle = gen->oca;
+	return config;
+}
+
+void GenerateController::GenerateDataInProcess() {
+	if (worker.joinable()) {
+		// Busy, pick up the latest parameters when the current trace is done
+		pending = true;
+		return;
+	}
+
+	if (source == NULL) {
+		source = Bitmap::LoadPNGImage(sourceFile);
+		if (source == NULL) {
+			Logger::GetLogger("GenerateController")->Error("Unable to load '%s'", sourceFile.c_str());
+			return;
+		}
+		trace.SetImage(source->Buffer(), source->Width(), source->Height());
+	}
+
+	lastConfig = ConfigFromParameters(this, trace.GetConfig());
+	trace.SetConfig(lastConfig);
+
+	workerDone = false;
+	worker = std::thread(&GenerateController::TraceWorker, this);
+}
+
+bool GenerateController::ParametersChanged() {
+	auto config = ConfigFromParameters(this, lastConfig);
+	return (contour::Trace::FirstChangedStage(lastConfig, config) != contour::Trace::kStage_Done);
+}
+
+void GenerateController::TraceWorker() {
+	Timer timer;
+	trace.Update();
+	// Intermediate imagery is drawn here, the UI thread only uploads it
+	imgContour = trace.DrawCluster(trace.ContourPoints());
+	imgSegments = trace.DrawLineSegments(trace.OptimizedSegments());
+	tLastTrace = timer.GetTime();
+	workerDone = true;
+}
+
+void GenerateController::Update() {
+	if ((externalProcess != NULL) && (externalProcess->IsFinished())) {
+		externalProcess->Wait();
+		Logger::GetLogger("GenerateController")->Debug("External generate done, exit status: %d", externalProcess->ExitStatus());
+		delete externalProcess;
+		externalProcess = NULL;
+	}
+
+	if (inProcess && liveUpdate && !worker.joinable() && ParametersChanged()) {
+		GenerateDataInProcess();
+	}
+	if (!worker.joinable() || !workerDone) {
+		return;
+	}
+	worker.join();
+
+	if (animController != NULL) {
+		contour::Config traced = trace.GetConfig();
+		animController->LoadData(trace.OptimizedSegments(), traced.Width, traced.Height);
+	}
+	if (imageController != NULL) {
+		imageController->SetImage("trace_contourpoints", imgContour);
+		imageController->SetImage("trace_linesegments", imgSegments);
+	} else {
+		delete imgContour;
+		delete imgSegments;
+	}
+	imgContour = NULL;
+	imgSegments = NULL;
+
+	Logger::GetLogger("GenerateController")->Debug("In-process trace done in %f sec", tLastTrace);
+
+	if (pending) {
+		pending = false;
+		GenerateDataInProcess();
+	}
 }
 
 std::string GenerateController::GetArg(const char *format, ...) {
@@ -141,13 +347,13 @@ void ProcessReadDefaults::OnProcessStarted() {
 }
 void ProcessReadDefaults::OnProcessExit() {
 }
-void ProcessReadDefaults::OnStdOutData(std::string data) {
-	strSettings = strSettings.append(data.c_str());
+void ProcessReadDefaults::OnStdOutData(const char *data, size_t len) {
+	strSettings.append(data, len);
 	// ILogger *logger = Logger::GetLogger("Defaults");
 	// logger->Debug("ReadData:\n%s", data.c_str());
 	// logger->Debug("SoFar:\n%s", strSettings.c_str());
 }
-void ProcessReadDefaults::OnStdErrData(std::string data) {
+void ProcessReadDefaults::OnStdErrData(const char *data, size_t len) {
 
 }
 /////////// Image handling
@@ -158,6 +364,14 @@ OpenGLImage *OpenGLImage::LoadPNG(std::string filename) {
 	}
 	return image;
 }
+// Takes ownership of the bitmap
+OpenGLImage *OpenGLImage::FromBitmap(std::string name, Bitmap *bitmap) {
+	auto image = new OpenGLImage(name);
+	if (!image->Replace(bitmap)) {
+		return NULL;
+	}
+	return image;
+}
 OpenGLImage::OpenGLImage(std::string filename) {
 	textureid = -1;
 	bitmap = NULL;
@@ -173,12 +387,28 @@ bool OpenGLImage::Reload() {
 		Logger::GetLogger("OpenGLImage")->Debug("Failed to load image");
 		return false;
 	}
+	return Upload();
+}
+
+bool OpenGLImage::Replace(Bitmap *newBitmap) {
+	if (newBitmap == NULL) {
+		return false;
+	}
+	if ((bitmap != NULL) && (bitmap != newBitmap)) {
+		delete bitmap;
+	}
+	bitmap = newBitmap;
+	return Upload();
+}
 
+bool OpenGLImage::Upload() {
 	auto err = glGetError();
 
 //	glEnable(GL_TEXTURE_2D);
 //	glActiveTexture(GL_TEXTURE0);	
-	glGenTextures(1, &textureid);
+	if (textureid == (GLuint)-1) {
+		glGenTextures(1, &textureid);
+	}
 	// printf("TextureID: %d\n", textureid);
 	// err = glGetError();
 	// printf("Err: %d\n", err);
@@ -222,6 +452,21 @@ void ImageController::ReloadAllImages() {
 	Logger::GetLogger("ImageController")->Error("ReloadAllImages not implemented!");
 }
 
+// Replaces the image with the same name or adds a new one, takes ownership of the bitmap
+bool ImageController::SetImage(std::string name, Bitmap *bitmap) {
+	for (int i=0;i<images.size();i++) {
+		if (images[i]->Name() == name) {
+			return images[i]->Replace(bitmap);
+		}
+	}
+	auto image = OpenGLImage::FromBitmap(name, bitmap);
+	if (image == NULL) {
+		return false;
+	}
+	images.push_back(image);
+	return true;
+}
+
 bool ImageController::LoadImage(std::string filename) {
 	auto image = OpenGLImage::LoadPNG(filename);
 	if (image == NULL) {
@@ -4,8 +4,11 @@
 
 #include "bitmap.h"
 #include <string>
+#include <thread>
+#include <atomic>
 #include "process.h"
 #include "animation.h"
+#include "contour.h"
 
 namespace gnilk {
 	class AnimController {
@@ -16,6 +19,7 @@ namespace gnilk {
 	public:
 		AnimController();
 		void LoadData(char *filename);
+		void LoadData(std::vector<contour::LineSegment *> &segments, int width, int height);
 		void ReloadData();
 		void ResetRenderVars();
 		int GetMaxFrames();
@@ -32,12 +36,14 @@ namespace gnilk {
 	public:
 		void OnProcessStarted();
 		void OnProcessExit();
-		void OnStdOutData(std::string data);
-		void OnStdErrData(std::string data);
+		void OnStdOutData(const char *data, size_t len);
+		void OnStdErrData(const char *data, size_t len);
 
 		std::string GetSettings();
 	};
 
+	class ImageController;
+
 	class GenerateController {
 	public:
 		// names corresponding to command line args
@@ -50,14 +56,42 @@ namespace gnilk {
 		float lld;	// Long Line Distance, break condition for new cluster/strip
 		float ccd;	// Cluster Cut off Distance
 		float oca;	// Optimization Cut off Angle, break condition for strip contcatination 
+		bool inProcess;	// Trace in a worker thread instead of spawning './contour'
+		bool liveUpdate;	// Re-trace whenever a parameter changes (in-process only)
 	public:
 		GenerateController();
+		virtual ~GenerateController();
+		void Attach(AnimController *animController, ImageController *imageController);
 		void ResetParameters();
 		void ReadDefaultSettings();
 		void GenerateData();	
+		void Update();
+		bool IsBusy() { return worker.joinable() || (externalProcess != NULL); }
+		double LastTraceTime() { return tLastTrace; }
 	private:
 		void ParseSettings(std::string strSettings);
 		std::string GetArg(const char *format, ...);
+
+		void GenerateDataInProcess();
+		void GenerateDataExternal();
+		bool ParametersChanged();
+		void TraceWorker();
+	private:
+		AnimController *animController;
+		ImageController *imageController;
+		Process *externalProcess;	// async './contour' run, NULL when idle
+
+		// In-process tracing, 'trace' is only touched by the worker while it runs
+		contour::Trace trace;
+		contour::Config lastConfig;
+		std::string sourceFile;
+		Bitmap *source;
+		std::thread worker;
+		std::atomic<bool> workerDone;
+		bool pending;
+		Bitmap *imgContour;
+		Bitmap *imgSegments;
+		double tLastTrace;
 	};	
 
 	class OpenGLImage {
@@ -67,9 +101,13 @@ namespace gnilk {
 		GLuint textureid;
 
 		OpenGLImage(std::string filename);
+		bool Upload();
 	public:
 		static OpenGLImage *LoadPNG(std::string filename);
+		static OpenGLImage *FromBitmap(std::string name, Bitmap *bitmap);
 		bool Reload();
+		bool Replace(Bitmap *newBitmap);
+		std::string Name() { return filename; }
 		GLuint GetTextureID();
 		int Width() { return bitmap->Width(); }
 		int Height() { return bitmap->Height(); }
@@ -83,6 +121,7 @@ namespace gnilk {
 		OpenGLImage *GetImage(int index);
 		void ReloadAllImages();
 		bool LoadImage(std::string filename);
+		bool SetImage(std::string name, Bitmap *bitmap);
 
 	};
 }
@@ -0,0 +1,308 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <algorithm>
+
+#include "videoio.h"
+#include "logger.h"
+
+using namespace gnilk;
+
+bool gnilk::ParseVideoFormat(const char *name, VideoFormat *format) {
+	if (!strcmp(name, "y4m")) {
+		*format = kVideoFormat_Y4M;
+	} else if (!strcmp(name, "grey") || !strcmp(name, "gray")) {
+		*format = kVideoFormat_Grey;
+	} else if (!strcmp(name, "rgba")) {
+		*format = kVideoFormat_RGBA;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+//
+// VideoReader
+//
+VideoReader::VideoReader() {
+	this->fd = -1;
+	this->format = kVideoFormat_Y4M;
+	this->width = 0;
+	this->height = 0;
+	this->numFrames = 0;
+	this->chromaBytes = 0;
+	this->limitedRange = false;
+}
+
+VideoReader::~VideoReader() {
+	Close();
+}
+
+bool VideoReader::Open(const std::string &filename, VideoFormat format, int width /*= 0*/, int height /*= 0*/) {
+	Close();
+	if (filename == "-") {
+		fd = dup(0);
+	} else {
+		fd = open(filename.c_str(), O_RDONLY);
+	}
+	if (fd < 0) {
+		CACHED_LOGGER("VideoIO")->Error("Unable to open '%s'", filename.c_str());
+		return false;
+	}
+	this->format = format;
+	this->width = width;
+	this->height = height;
+	this->numFrames = 0;
+	this->chromaBytes = 0;
+	this->limitedRange = false;
+	if ((format == kVideoFormat_Y4M) && !ReadY4MHeader()) {
+		Close();
+		return false;
+	}
+	if ((this->width < 1) || (this->height < 1)) {
+		CACHED_LOGGER("VideoIO")->Error("Invalid frame size %dx%d for '%s'", this->width, this->height, filename.c_str());
+		Close();
+		return false;
+	}
+	frame.resize((size_t)this->width * this->height * BytesPerPixel());
+	chroma.resize(chromaBytes);
+	if (limitedRange) {
+		// 16..235 -> 0..255, rounded
+		for (int i=0;i<256;i++) {
+			int v = ((i - 16) * 255 + 109) / 219;
+			rangeLut[i] = (uint8_t)std::max(0, std::min(v, 255));
+		}
+	}
+	return true;
+}
+
+void VideoReader::Close() {
+	if (fd >= 0) {
+		close(fd);
+		fd = -1;
+	}
+}
+
+//
+// 'YUV4MPEG2 W<w> H<h> F<n:d> I<i> A<n:d> C<colorspace> X<ext>', only W, H, C and
+// XCOLORRANGE matter here. Frame rate and aspect are not needed for tracing.
+//
+bool VideoReader::ReadY4MHeader() {
+	std::string header;
+	if (!ReadLine(header) || (header.compare(0, 9, "YUV4MPEG2") != 0)) {
+		CACHED_LOGGER("VideoIO")->Error("Not a Y4M stream");
+		return false;
+	}
+	std::string colorspace("420jpeg");
+	int range = -1;
+	size_t pos = 9;
+	while(pos < header.length()) {
+		size_t end = header.find(' ', pos);
+		if (end == std::string::npos) {
+			end = header.length();
+		}
+		std::string tag = header.substr(pos, end - pos);
+		pos = end + 1;
+		if (tag.empty()) {
+			continue;
+		}
+		switch(tag[0]) {
+			case 'W' :
+				width = atoi(tag.c_str() + 1);
+				break;
+			case 'H' :
+				height = atoi(tag.c_str() + 1);
+				break;
+			case 'C' :
+				colorspace = tag.substr(1);
+				break;
+			case 'X' :
+				if (tag == "XCOLORRANGE=FULL") {
+					range = 0;
+				} else if (tag == "XCOLORRANGE=LIMITED") {
+					range = 1;
+				}
+				break;
+		}
+	}
+
+	size_t cw2 = (width + 1) / 2;
+	size_t ch2 = (height + 1) / 2;
+	if ((colorspace == "420") || (colorspace == "420jpeg") || (colorspace == "420paldv") || (colorspace == "420mpeg2")) {
+		// Chroma siting doesn't matter for the Y plane
+		chromaBytes = 2 * cw2 * ch2;
+	} else if (colorspace == "422") {
+		chromaBytes = 2 * cw2 * height;
+	} else if (colorspace == "444") {
+		chromaBytes = 2 * (size_t)width * height;
+	} else if (colorspace == "444alpha") {
+		chromaBytes = 3 * (size_t)width * height;
+	} else if (colorspace == "411") {
+		chromaBytes = 2 * (size_t)((width + 3) / 4) * height;
+	} else if (colorspace == "mono") {
+		chromaBytes = 0;
+	} else {
+		CACHED_LOGGER("VideoIO")->Error("Unsupported Y4M colorspace 'C%s', only 8-bit is supported", colorspace.c_str());
+		return false;
+	}
+	// ffmpeg writes full range grey as 'Cmono', YUV without a range tag is video range
+	limitedRange = (range < 0) ? (colorspace != "mono") : (range == 1);
+	CACHED_LOGGER("VideoIO")->Info("Y4M %dx%d, C%s, %s range", width, height, colorspace.c_str(), limitedRange ? "limited" : "full");
+	return true;
+}
+
+bool VideoReader::ReadFrame() {
+	if (fd < 0) {
+		return false;
+	}
+	if (format == kVideoFormat_Y4M) {
+		std::string line;
+		if (!ReadLine(line)) {
+			return false;
+		}
+		if (line.compare(0, 5, "FRAME") != 0) {
+			CACHED_LOGGER("VideoIO")->Error("Expected FRAME at frame %d", numFrames);
+			return false;
+		}
+	}
+	if (!ReadFully(frame.data(), frame.size())) {
+		return false;
+	}
+	if ((chromaBytes > 0) && !ReadFully(chroma.data(), chromaBytes)) {
+		return false;
+	}
+	if (limitedRange) {
+		for (size_t i=0;i<frame.size();i++) {
+			frame[i] = rangeLut[frame[i]];
+		}
+	}
+	numFrames++;
+	return true;
+}
+
+// Header and frame lines are short, byte reads keep the stream position exact
+bool VideoReader::ReadLine(std::string &line) {
+	line.clear();
+	char c;
+	while(true) {
+		ssize_t res = read(fd, &c, 1);
+		if ((res < 0) && (errno == EINTR)) {
+			continue;
+		}
+		if (res <= 0) {
+			return false;
+		}
+		if (c == '\n') {
+			return true;
+		}
+		line.push_back(c);
+		if (line.length() > 1024) {
+			return false;
+		}
+	}
+}
+
+// Pipes return partial reads, loop until the frame is complete
+bool VideoReader::ReadFully(unsigned char *dst, size_t numBytes) {
+	size_t numRead = 0;
+	while(numRead < numBytes) {
+		ssize_t res = read(fd, dst + numRead, numBytes - numRead);
+		if ((res < 0) && (errno == EINTR)) {
+			continue;
+		}
+		if (res <= 0) {
+			if (numRead > 0) {
+				CACHED_LOGGER("VideoIO")->Error("Truncated frame %d, %d of %d bytes", numFrames, (int)numRead, (int)numBytes);
+			}
+			return false;
+		}
+		numRead += res;
+	}
+	return true;
+}
+
+//
+// VideoWriter
+//
+VideoWriter::VideoWriter() {
+	this->fd = -1;
+	this->format = kVideoFormat_Y4M;
+	this->width = 0;
+	this->height = 0;
+	this->numFrames = 0;
+}
+
+VideoWriter::~VideoWriter() {
+	Close();
+}
+
+bool VideoWriter::Open(const std::string &filename, VideoFormat format, int width, int height, int fps) {
+	Close();
+	if ((width < 1) || (height < 1)) {
+		CACHED_LOGGER("VideoIO")->Error("Invalid frame size %dx%d for '%s'", width, height, filename.c_str());
+		return false;
+	}
+	if (filename == "-") {
+		fd = dup(1);
+	} else {
+		fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	}
+	if (fd < 0) {
+		CACHED_LOGGER("VideoIO")->Error("Unable to open '%s'", filename.c_str());
+		return false;
+	}
+	this->format = format;
+	this->width = width;
+	this->height = height;
+	this->numFrames = 0;
+	if (format == kVideoFormat_Y4M) {
+		char header[128];
+		int len = snprintf(header, sizeof(header), "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 Cmono XCOLORRANGE=FULL\n", width, height, fps);
+		if (!WriteFully(header, len)) {
+			Close();
+			return false;
+		}
+	}
+	return true;
+}
+
+void VideoWriter::Close() {
+	if (fd >= 0) {
+		close(fd);
+		fd = -1;
+	}
+}
+
+bool VideoWriter::WriteFrame(const unsigned char *data) {
+	if (fd < 0) {
+		return false;
+	}
+	if ((format == kVideoFormat_Y4M) && !WriteFully("FRAME\n", 6)) {
+		return false;
+	}
+	if (!WriteFully(data, (size_t)width * height * BytesPerPixel())) {
+		return false;
+	}
+	numFrames++;
+	return true;
+}
+
+bool VideoWriter::WriteFully(const void *src, size_t numBytes) {
+	const unsigned char *ptr = (const unsigned char *)src;
+	while(numBytes > 0) {
+		ssize_t res = write(fd, ptr, numBytes);
+		if ((res < 0) && (errno == EINTR)) {
+			continue;
+		}
+		if (res <= 0) {
+			CACHED_LOGGER("VideoIO")->Error("Write failed at frame %d", numFrames);
+			return false;
+		}
+		ptr += res;
+		numBytes -= res;
+	}
+	return true;
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace gnilk {
+
+	typedef enum {
+		kVideoFormat_Y4M = 0,		// 8-bit planar YUV or mono with a stream header
+		kVideoFormat_Grey = 1,		// headerless, 1 byte per pixel
+		kVideoFormat_RGBA = 2,		// headerless, 4 bytes per pixel
+	} VideoFormat;
+
+	// "y4m", "grey" (or "gray") and "rgba"
+	bool ParseVideoFormat(const char *name, VideoFormat *format);
+
+	//
+	// Uncompressed frames from a file, FIFO or stdin ("-"). Nothing is seeked so pipes work,
+	// e.g. 'ffmpeg -i clip.mp4 -pix_fmt gray -f yuv4mpegpipe - | player -v out.db -'.
+	// Y4M frames are 8-bit, only the Y plane is kept and limited range Y is expanded to 0..255.
+	// Raw frames are headerless grey (1 byte per pixel) or RGBA at a given size.
+	//
+	class VideoReader {
+	public:
+		VideoReader();
+		virtual ~VideoReader();
+
+		bool Open(const std::string &filename, VideoFormat format, int width = 0, int height = 0);
+		void Close();
+		// Next frame to Buffer(), false at the end of the stream or on a truncated frame
+		bool ReadFrame();
+
+		int Width() { return width; }
+		int Height() { return height; }
+		int BytesPerPixel() { return (format == kVideoFormat_RGBA) ? 4 : 1; }
+		unsigned char *Buffer() { return frame.data(); }
+		int NumFrames() { return numFrames; }
+	private:
+		bool ReadY4MHeader();
+		bool ReadLine(std::string &line);
+		bool ReadFully(unsigned char *dst, size_t numBytes);
+	private:
+		int fd;
+		VideoFormat format;
+		int width;
+		int height;
+		int numFrames;
+		size_t chromaBytes;			// Y4M, skipped after the Y plane of each frame
+		bool limitedRange;
+		uint8_t rangeLut[256];
+		std::vector<unsigned char> frame;	// reused for every frame
+		std::vector<unsigned char> chroma;
+	};
+
+	//
+	// Frames to a file, FIFO or stdout ("-"), e.g. 'player -x strips.db - | ffmpeg -i - video.mp4'.
+	// Y4M is written as full range 'Cmono', the caller's buffer is written as is.
+	//
+	class VideoWriter {
+	public:
+		VideoWriter();
+		virtual ~VideoWriter();
+
+		bool Open(const std::string &filename, VideoFormat format, int width, int height, int fps);
+		void Close();
+		bool WriteFrame(const unsigned char *data);
+
+		int Width() { return width; }
+		int Height() { return height; }
+		int BytesPerPixel() { return (format == kVideoFormat_RGBA) ? 4 : 1; }
+		int NumFrames() { return numFrames; }
+	private:
+		bool WriteFully(const void *src, size_t numBytes);
+	private:
+		int fd;
+		VideoFormat format;
+		int width;
+		int height;
+		int numFrames;
+	};
+}